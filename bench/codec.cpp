@@ -0,0 +1,222 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Cost of every text conversion in the codec, compared with the Qt
+ * code it replaced:
+ *
+ *   hex encode     Codec::encodeHex       QByteArray::toHex
+ *   hex decode     Codec::decodeHex       QByteArray::fromHex
+ *   id format      Codec::formatId        QByteArray::toHex of 20 bytes
+ *   id parse       Codec::parseId         QByteArray::fromHex of 40 digits
+ *   endpoint fmt   Codec::formatEndpoint  inet_ntop and QString::arg
+ *   endpoint parse Codec::parseEndpoint   QUrl, QHostAddress and inet_pton
+ *
+ * The bulk hex rows convert a list of 10000 hashes at once.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <arpa/inet.h>
+
+#include <QByteArray>
+#include <QHostAddress>
+#include <QString>
+#include <QUrl>
+
+#include "codec.h"
+
+typedef std::chrono::steady_clock Clock;
+
+static const int numIds = 10000;
+static const int rounds = 50;
+
+/* Keeps the compiler from dropping the results */
+static volatile size_t sink;
+
+template<typename F>
+static double nsPerItem(long items, F f)
+{
+    auto start = Clock::now();
+    f();
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / items;
+}
+
+/* Endpoint::toString() before the codec */
+static QString oldToString(const Endpoint &e)
+{
+    char buffer[INET6_ADDRSTRLEN];
+    if(e.family == 4) {
+        inet_ntop(AF_INET, e.addr, buffer, sizeof(buffer));
+        return QString("%1:%2").arg(buffer).arg(e.portNumber());
+    }
+    inet_ntop(AF_INET6, e.addr, buffer, sizeof(buffer));
+    return QString("[%1]:%2").arg(buffer).arg(e.portNumber());
+}
+
+/* Bootstrap node parsing in DhtEngine::init() before the codec */
+static bool oldParse(const QString &s, sockaddr_storage &ss)
+{
+    QUrl url(QString("http://%1").arg(s));
+    if(not url.isValid())
+        return false;
+
+    auto ip = url.host();
+    memset(&ss, 0, sizeof(ss));
+    if(QHostAddress(ip).protocol() == QAbstractSocket::IPv4Protocol) {
+        auto a4 = (sockaddr_in *) &ss;
+        a4->sin_family = AF_INET;
+        a4->sin_port = htons(url.port());
+        return inet_pton(AF_INET, ip.toLatin1().data(), &a4->sin_addr) == 1;
+    }
+    auto a6 = (sockaddr_in6 *) &ss;
+    a6->sin6_family = AF_INET6;
+    a6->sin6_port = htons(url.port());
+    return inet_pton(AF_INET6, ip.toLatin1().data(), &a6->sin6_addr) == 1;
+}
+
+static void row(const char *name, double codec, double qt)
+{
+    printf("%-16s %12.1f %12.1f %8.1fx\n", name, codec, qt, qt / codec);
+}
+
+int main(void)
+{
+    std::mt19937 rng(1);
+
+    std::vector<NodeId> ids(numIds);
+    for(auto &id : ids) {
+        for(auto &b : id.data)
+            b = rng();
+    }
+    const unsigned char *raw = ids[0].data;
+    size_t rawSize = numIds * NodeId::size;
+
+    std::vector<Endpoint> endpoints(numIds);
+    for(int i=0; i<numIds; i++) {
+        unsigned char compact[18];
+        for(auto &b : compact)
+            b = rng();
+        endpoints[i] = i % 10 == 0 ? Endpoint::fromCompact6(compact) : Endpoint::fromCompact4(compact);
+    }
+
+    std::vector<char> hex(2 * rawSize);
+    std::vector<unsigned char> bytes(rawSize);
+    QByteArray qraw((const char *) raw, rawSize);
+    QByteArray qhex = qraw.toHex();
+
+    std::vector<QByteArray> hexIds;
+    std::vector<QByteArray> texts;
+    std::vector<QString> qtexts;
+    for(int i=0; i<numIds; i++) {
+        hexIds.push_back(QByteArray((const char *) ids[i].data, NodeId::size).toHex().toUpper());
+        char buffer[Codec::maxEndpointLength];
+        texts.push_back(QByteArray(buffer, Codec::formatEndpoint(endpoints[i], buffer)));
+        qtexts.push_back(QString::fromLatin1(texts.back()));
+    }
+
+    printf("%-16s %12s %12s %9s\n", "", "codec [ns]", "qt [ns]", "speedup");
+
+    long n = (long) rounds * numIds;
+    row("hex encode bulk",
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++) {
+                Codec::encodeHex(raw, rawSize, hex.data());
+                sink += hex[r];
+            }
+        }),
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++)
+                sink += qraw.toHex().size();
+        }));
+
+    row("hex decode bulk",
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++)
+                sink += Codec::decodeHex(qhex.constData(), rawSize, bytes.data());
+        }),
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++)
+                sink += QByteArray::fromHex(qhex).size();
+        }));
+
+    row("id format",
+        nsPerItem(n, [&]() {
+            char buffer[Codec::idLength];
+            for(int r=0; r<rounds; r++) {
+                for(auto &id : ids) {
+                    Codec::formatId(id, buffer);
+                    sink += buffer[0];
+                }
+            }
+        }),
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++) {
+                for(auto &id : ids)
+                    sink += QByteArray((const char *) id.data, NodeId::size).toHex().size();
+            }
+        }));
+
+    row("id parse",
+        nsPerItem(n, [&]() {
+            NodeId id;
+            for(int r=0; r<rounds; r++) {
+                for(auto &h : hexIds)
+                    sink += Codec::parseId(h, id);
+            }
+        }),
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++) {
+                for(auto &h : hexIds)
+                    sink += QByteArray::fromHex(h).size();
+            }
+        }));
+
+    row("endpoint format",
+        nsPerItem(n, [&]() {
+            char buffer[Codec::maxEndpointLength];
+            for(int r=0; r<rounds; r++) {
+                for(auto &e : endpoints)
+                    sink += Codec::formatEndpoint(e, buffer);
+            }
+        }),
+        nsPerItem(n, [&]() {
+            for(int r=0; r<rounds; r++) {
+                for(auto &e : endpoints)
+                    sink += oldToString(e).size();
+            }
+        }));
+
+    row("endpoint parse",
+        nsPerItem(n, [&]() {
+            Endpoint e;
+            for(int r=0; r<rounds; r++) {
+                for(auto &t : texts)
+                    sink += Codec::parseEndpoint(t.constData(), t.size(), e);
+            }
+        }),
+        nsPerItem(numIds, [&]() {
+            sockaddr_storage ss;
+            for(auto &t : qtexts)
+                sink += oldParse(t, ss);
+        }));
+
+    return 0;
+}
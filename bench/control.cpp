@@ -0,0 +1,158 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Round trip time of the control socket of a running node.
+ *
+ *   bench-control <socket> [requests] [hash]
+ *
+ * Sends "ping" one at a time and waits for every "pong", then the same
+ * number of pings back to back. With a hash, every request is a
+ * "refresh" of that search followed by a "cancel", which includes the
+ * dht_search() calls.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+
+/* Read up to and including the next newline, buffered */
+static bool readLine(int fd, std::string &buffer, std::string &line)
+{
+    for(;;) {
+        size_t end = buffer.find('\n');
+        if(end != std::string::npos) {
+            line = buffer.substr(0, end);
+            buffer.erase(0, end + 1);
+            return true;
+        }
+
+        char data[4096];
+        ssize_t n = read(fd, data, sizeof(data));
+        if(n <= 0)
+            return false;
+        buffer.append(data, n);
+    }
+}
+
+/* Read replies until one starts with prefix, skipping pushed results */
+static bool expect(int fd, std::string &buffer, const char *prefix)
+{
+    std::string line;
+    while(readLine(fd, buffer, line)) {
+        if(line.compare(0, strlen(prefix), prefix) == 0)
+            return true;
+        if(line.compare(0, 6, "error ") == 0) {
+            fprintf(stderr, "%s\n", line.c_str());
+            return false;
+        }
+    }
+    return false;
+}
+
+static bool sendAll(int fd, const std::string &data)
+{
+    size_t done = 0;
+    while(done < data.size()) {
+        ssize_t n = write(fd, data.data() + done, data.size() - done);
+        if(n <= 0)
+            return false;
+        done += n;
+    }
+    return true;
+}
+
+static double percentile(std::vector<double> &v, double p)
+{
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (p * v.size()))];
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2) {
+        fprintf(stderr, "usage: %s <socket> [requests] [hash]\n", argv[0]);
+        return 1;
+    }
+    int requests = argc > 2 ? atoi(argv[2]) : 10000;
+    std::string hash = argc > 3 ? argv[3] : "";
+
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 or connect(fd, (sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        return 1;
+    }
+
+    std::string request, reply;
+    if(hash.empty()) {
+        request = "ping\n";
+        reply = "pong";
+    }
+    else {
+        request = "refresh " + hash + "\ncancel " + hash + "\n";
+        reply = "ok cancel";
+    }
+
+    std::string buffer;
+    std::vector<double> rtt;
+    rtt.reserve(requests);
+
+    for(int i=0; i<requests; i++) {
+        auto start = Clock::now();
+        if(not sendAll(fd, request) or not expect(fd, buffer, reply.c_str()))
+            return 1;
+        rtt.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+    }
+
+    std::string batch;
+    for(int i=0; i<requests; i++)
+        batch += request;
+
+    auto start = Clock::now();
+    if(not sendAll(fd, batch))
+        return 1;
+    for(int i=0; i<requests; i++) {
+        if(not expect(fd, buffer, reply.c_str()))
+            return 1;
+    }
+    double pipelined = std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+    printf("%d requests (%s)\n", requests, hash.empty() ? "ping" : "refresh and cancel");
+    double p50 = percentile(rtt, 0.5);
+    double p99 = percentile(rtt, 0.99);
+    printf("round trip     p50 %8.1f us  p99 %8.1f us  max %8.1f us\n", p50, p99, rtt.back());
+    printf("pipelined      %8.2f us per request\n", pipelined / requests);
+
+    close(fd);
+    return 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Syscalls per datagram and timer precision of the DHT event loop.
+ *
+ * A sender thread sends datagrams to a loopback socket at a fixed rate
+ * while the receiver drives a stand-in for dht_periodic, which asks to
+ * be called at the start of every second like dht.c with active
+ * searches. Two loops are compared:
+ *
+ *   poll      Model of QSocketNotifier and a single-shot QTimer, the
+ *             timer is restarted with tosleep seconds after every call.
+ *   reactor   Reactor with epoll and timerfd, the timer is only armed
+ *             when the deadline moves earlier.
+ *
+ * Under Qt, every dispatch of the reactor follows a poll() of the event
+ * loop on the reactor's descriptor, so that column adds the waits once
+ * more. Syscalls are counted where the loops make them.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <poll.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "reactor.h"
+#include "recvbatch.h"
+
+
+struct Counts
+{
+    uint64_t datagrams = 0;
+    uint64_t waits = 0;             /* poll() or epoll_wait() */
+    uint64_t receives = 0;          /* recvmmsg() */
+    uint64_t timerArms = 0;         /* timerfd_settime() */
+    uint64_t periodic = 0;          /* Calls of the stand-in */
+    uint64_t maintenance = 0;       /* Deadlines reached */
+    double lateness = 0;            /* Sum of ms between deadline and call */
+};
+
+/**
+ * Stand-in for dht_periodic. Its deadline is the start of the next
+ * second, like dht.c, and it returns the whole seconds until then.
+ */
+class Periodic
+{
+public:
+    explicit Periodic(Counts &counts) : counts(counts), next(0) { }
+
+    time_t call(void)
+    {
+        timeval tv;
+        gettimeofday(&tv, nullptr);
+        counts.periodic++;
+
+        if(next == 0) {
+            next = tv.tv_sec + 1;
+        }
+        else if(tv.tv_sec >= next) {
+            counts.maintenance++;
+            counts.lateness += (tv.tv_sec - next) * 1000.0 + tv.tv_usec / 1000.0;
+            next = tv.tv_sec + 1;
+        }
+        usec = tv.tv_usec;
+        return next - tv.tv_sec;
+    }
+
+    long usec;                      /* Sub-second part of the last call */
+
+private:
+    Counts &counts;
+    time_t next;
+};
+
+static void drain(int s, RecvBatch &batch, Counts &counts, Periodic &periodic)
+{
+    for(;;) {
+        int n = batch.receive(s);
+        counts.receives++;
+        if(n <= 0)
+            break;
+        for(int i=0; i<n; i++)
+            periodic.call();
+        counts.datagrams += n;
+        if(n < RecvBatch::size)
+            break;
+    }
+}
+
+static void runPoll(int s, int64_t end, Counts &counts)
+{
+    RecvBatch batch;
+    Periodic periodic(counts);
+    int64_t deadline = Reactor::now() + 1000 * periodic.call();
+
+    while(Reactor::now() < end) {
+        pollfd pfd = { s, POLLIN, 0 };
+        int timeout = std::max<int64_t>(deadline - Reactor::now(), 0);
+        int rc = poll(&pfd, 1, timeout);
+        counts.waits++;
+
+        time_t tosleep;
+        if(rc > 0) {
+            drain(s, batch, counts, periodic);
+            tosleep = periodic.call();
+        }
+        else {
+            tosleep = periodic.call();
+        }
+        /* QTimer::stop() and start() don't make syscalls */
+        deadline = Reactor::now() + 1000 * tosleep;
+    }
+}
+
+static void runReactor(int s, int64_t end, Counts &counts)
+{
+    RecvBatch batch;
+    Periodic periodic(counts);
+    Reactor reactor;
+    if(not reactor.init()) {
+        perror("reactor");
+        exit(1);
+    }
+
+    int timer = -1;
+    auto schedule = [&](time_t tosleep) {
+        reactor.scheduleIn(timer, tosleep * 1000 - periodic.usec / 1000);
+        if(Reactor::now() >= end)
+            reactor.stop();
+    };
+
+    reactor.addSocket(s, [&](int s) {
+        drain(s, batch, counts, periodic);
+        schedule(periodic.call());
+    });
+    timer = reactor.addTimer([&]() {
+        schedule(periodic.call());
+    });
+    schedule(periodic.call());
+    reactor.run();
+
+    counts.waits = reactor.stats().waits;
+    counts.timerArms = reactor.stats().timerArms;
+}
+
+int main(int argc, char *argv[])
+{
+    int rate = argc > 1 ? atoi(argv[1]) : 2000;         /* Datagrams per second */
+    int seconds = argc > 2 ? atoi(argv[2]) : 5;
+
+    int rx = socket(AF_INET, SOCK_DGRAM, 0);
+    int tx = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in sin = {};
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(sin);
+    if(bind(rx, (sockaddr *) &sin, sizeof(sin)) < 0 or
+       getsockname(rx, (sockaddr *) &sin, &len) < 0) {
+        perror("bind");
+        return 1;
+    }
+
+    printf("%d datagrams/s for %d s per loop\n\n", rate, seconds);
+    printf("%-14s %10s %10s %10s %12s %12s\n", "", "datagrams", "wakeups",
+           "syscalls", "per datagram", "lateness [ms]");
+
+    for(int mode=0; mode<2; mode++) {
+        Counts counts;
+        std::atomic<bool> sending(true);
+        int64_t end = Reactor::now() + seconds * 1000;
+
+        /* Send in 1 ms steps at the requested rate */
+        std::thread sender([&]() {
+            char payload[100] = "d1:ad2:id20:xxxxxxxxxxxxxxxxxxxxe1:q4:ping1:t2:aa1:y1:qe";
+            auto t = std::chrono::steady_clock::now();
+            double credit = 0;
+            while(sending) {
+                credit += rate / 1000.0;
+                for(; credit >= 1; credit--)
+                    sendto(tx, payload, sizeof(payload), 0, (sockaddr *) &sin, sizeof(sin));
+                t += std::chrono::milliseconds(1);
+                std::this_thread::sleep_until(t);
+            }
+        });
+
+        if(mode == 0)
+            runPoll(rx, end, counts);
+        else
+            runReactor(rx, end, counts);
+        sending = false;
+        sender.join();
+
+        /* Empty the socket for the next loop */
+        RecvBatch batch;
+        while(batch.receive(rx) > 0) { }
+
+        uint64_t syscalls = counts.waits + counts.receives + counts.timerArms;
+        double d = std::max<uint64_t>(counts.datagrams, 1);
+        double late = counts.lateness / std::max<uint64_t>(counts.maintenance, 1);
+        if(mode == 0) {
+            printf("%-14s %10llu %10llu %10llu %12.3f %12.1f\n", "poll",
+                   (unsigned long long) counts.datagrams, (unsigned long long) counts.waits,
+                   (unsigned long long) syscalls, syscalls / d, late);
+        }
+        else {
+            printf("%-14s %10llu %10llu %10llu %12.3f %12.1f\n", "reactor",
+                   (unsigned long long) counts.datagrams, (unsigned long long) counts.waits,
+                   (unsigned long long) syscalls, syscalls / d, late);
+            printf("%-14s %10s %10s %10llu %12.3f\n", "reactor in Qt", "", "",
+                   (unsigned long long) (syscalls + counts.waits), (syscalls + counts.waits) / d);
+            printf("\ntimerfd_settime() on %.1f%% of the reactor wakeups\n",
+                   100.0 * counts.timerArms / std::max<uint64_t>(counts.waits, 1));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,354 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * Replays a capture recorded with --capture into dht.c.
+ *
+ * The calls are fed to dht.c in their original order, with the clock,
+ * the random bytes and the filter decisions of the recording, so dht.c
+ * goes through the same states and sends the same replies. The replies
+ * are discarded, but counted and hashed. Two builds that behave the
+ * same print the same checksum.
+ *
+ * Records are replayed as fast as possible, or with their original
+ * pacing with --realtime. Reports the time spent in dht_periodic and
+ * in the callback, which does the same work as DhtEngine's.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QFile>
+
+#include "capture.h"
+#include "dhtinternal.h"
+#include "nodeid.h"
+#include "peeridset.h"
+#include "peertable.h"
+#include "searchregistry.h"
+#include "dht/dht.h"
+
+using Clock = std::chrono::steady_clock;
+
+
+/**
+ * State of the replay, shared with the functions dht.c calls
+ */
+struct Replay
+{
+    uint64_t start = 0;             /* Time the capture was opened */
+    uint64_t time = 0;              /* Timestamp of the current call */
+
+    /* Input of the current call */
+    std::vector<capture_record> randoms;
+    size_t nextRandom = 0;
+    std::vector<uint32_t> blocked;  /* Filter calls that dropped the source */
+    size_t nextBlocked = 0;
+    uint32_t filterCalls = 0;
+    uint64_t diverged = 0;          /* Calls that didn't consume their input */
+
+    uint64_t sent = 0;
+    uint64_t sentBytes = 0;
+    uint64_t checksum = 14695981039346656037ULL;    /* FNV-1a of all sent datagrams */
+
+    PeerTable peers;
+    SearchRegistry<PeerIdSet> searches;
+    uint64_t callbacks = 0;
+    uint64_t values = 0;            /* New peers found by the searches */
+    Clock::duration callbackTime = Clock::duration::zero();
+};
+
+static Replay replay;
+
+static void replayClock(struct timeval *tv)
+{
+    capture_clock(replay.start, replay.time, tv);
+}
+
+static int replayRandom(void *buf, size_t size)
+{
+    if(replay.nextRandom < replay.randoms.size() and
+       size_t(replay.randoms[replay.nextRandom].datalen) == size) {
+        memcpy(buf, replay.randoms[replay.nextRandom++].data, size);
+        return size;
+    }
+
+    replay.diverged++;
+    return dht_random_bytes(buf, size);
+}
+
+static int replayFilter(const struct sockaddr *, int)
+{
+    uint32_t index = replay.filterCalls++;
+    if(replay.nextBlocked < replay.blocked.size() and replay.blocked[replay.nextBlocked] == index) {
+        replay.nextBlocked++;
+        return 1;
+    }
+    return 0;
+}
+
+static ssize_t replaySend(int, const void *buf, size_t len, int,
+                          const struct sockaddr *to, socklen_t tolen)
+{
+    auto hash = [](const void *data, size_t n) {
+        auto p = (const unsigned char *) data;
+        for(size_t i=0; i<n; i++) {
+            replay.checksum ^= p[i];
+            replay.checksum *= 1099511628211ULL;
+        }
+    };
+
+    hash(to, tolen);
+    hash(buf, len);
+    replay.sent++;
+    replay.sentBytes += len;
+    return len;
+}
+
+/**
+ * Same work as DhtEngine::dhtCallback, without the signals and events
+ */
+static void replayCallback(void *, int event, const unsigned char *info_hash,
+                           const void *data, size_t data_len)
+{
+    auto start = Clock::now();
+    replay.callbacks++;
+
+    PeerIdSet *results = replay.searches.find(NodeId::fromBytes(info_hash));
+    if(results and (event == DHT_EVENT_VALUES or event == DHT_EVENT_VALUES6)) {
+        bool v6 = event == DHT_EVENT_VALUES6;
+        size_t step = v6 ? 18 : 6;
+
+        auto values = (const unsigned char *) data;
+        for(size_t i=0; i+step<=data_len; i+=step) {
+            auto peer = v6 ? Endpoint::fromCompact6(&values[i])
+                           : Endpoint::fromCompact4(&values[i]);
+            replay.values += results->insert(replay.peers.intern(peer));
+        }
+        results->merge();
+    }
+
+    replay.callbackTime += Clock::now() - start;
+}
+
+/**
+ * Durations of one kind of call
+ */
+struct CallStats
+{
+    std::vector<uint32_t> ns;
+    uint64_t total = 0;
+
+    void add(Clock::duration d)
+    {
+        uint64_t n = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+        ns.push_back(std::min<uint64_t>(n, UINT32_MAX));
+        total += n;
+    }
+
+    double percentile(double p)
+    {
+        if(ns.empty())
+            return 0;
+        size_t i = std::min(ns.size() - 1, size_t(p * ns.size()));
+        std::nth_element(ns.begin(), ns.begin() + i, ns.end());
+        return ns[i] / 1000.0;
+    }
+
+    void print(const char *name)
+    {
+        printf("%-22s %10zu %10.3f %9.1f %9.1f %9.1f\n", name, ns.size(), total / 1e9,
+               percentile(0.5), percentile(0.99), percentile(1.0));
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replay a capture into dht.c");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("realtime", "Keep the pacing of the recording."));
+    parser.addPositionalArgument("capture", "File recorded with --capture.");
+    parser.process(app);
+
+    if(parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+
+    QFile file(parser.positionalArguments().first());
+    if(not file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "Can't open %s\n", qPrintable(file.fileName()));
+        return 1;
+    }
+
+    size_t size = file.size();
+    const unsigned char *buf = file.map(0, size);
+    if(not buf or capture_parse_header(buf, size, &replay.start) < 0) {
+        fprintf(stderr, "%s isn't a capture\n", qPrintable(file.fileName()));
+        return 1;
+    }
+
+    dht_internal_set_clock_function(replayClock);
+    dht_internal_set_random_function(replayRandom);
+    dht_internal_set_filter_function(replayFilter);
+    dht_internal_set_send_function(replaySend);
+
+    CallStats datagramCalls, timerCalls;
+    uint64_t searches = 0, others = 0;
+    bool initialized = false;
+    std::vector<char> datagram(65536 + 1);
+
+    size_t offset = CAPTURE_HEADER_SIZE;
+    capture_record rec = {}, call = {};
+    int rc = capture_parse(buf, size, &offset, &rec);
+
+    auto wallStart = Clock::now();
+    uint64_t firstTime = rc > 0 ? rec.time : 0;
+
+    while(rc > 0) {
+        call = rec;
+
+        /* The input dht.c took during the call follows it */
+        replay.randoms.clear();
+        replay.blocked.clear();
+        while((rc = capture_parse(buf, size, &offset, &rec)) > 0) {
+            if(rec.type == CAPTURE_RANDOM) {
+                replay.randoms.push_back(rec);
+            }
+            else if(rec.type == CAPTURE_BLOCKED and rec.datalen == 4) {
+                uint32_t index;
+                memcpy(&index, rec.data, 4);
+                replay.blocked.push_back(index);
+            }
+            else {
+                break;
+            }
+        }
+        replay.nextRandom = 0;
+        replay.nextBlocked = 0;
+        replay.filterCalls = 0;
+        replay.time = call.time;
+
+        if(parser.isSet("realtime"))
+            std::this_thread::sleep_until(wallStart + std::chrono::nanoseconds(call.time - firstTime));
+
+        if(not initialized and call.type != CAPTURE_INIT) {
+            fprintf(stderr, "The capture doesn't start with dht_init\n");
+            return 1;
+        }
+
+        sockaddr_storage ss;
+        int salen = capture_address(&call, &ss);
+        time_t tosleep;
+
+        switch(call.type) {
+        case CAPTURE_INIT:
+            if(initialized or call.datalen != 25) {
+                fprintf(stderr, "Unexpected dht_init in the capture\n");
+                return 1;
+            }
+            /* dht.c only needs the sockets to exist, nothing is sent on them */
+            dht_init((call.data[24] & 1) ? socket(AF_INET, SOCK_DGRAM, 0) : -1,
+                     (call.data[24] & 2) ? socket(AF_INET6, SOCK_DGRAM, 0) : -1,
+                     call.data, call.data + 20);
+            initialized = true;
+            break;
+
+        case CAPTURE_PERIODIC: {
+            /* dht_periodic expects a terminating null byte */
+            memcpy(datagram.data(), call.data, call.datalen);
+            datagram[call.datalen] = '\0';
+
+            auto start = Clock::now();
+            dht_periodic(call.datalen > 0 ? datagram.data() : nullptr, call.datalen,
+                         salen > 0 ? (sockaddr *) &ss : nullptr, salen,
+                         &tosleep, replayCallback, nullptr);
+            (call.datalen > 0 ? datagramCalls : timerCalls).add(Clock::now() - start);
+            break;
+        }
+
+        case CAPTURE_SEARCH:
+            if(call.datalen == 23) {
+                auto id = NodeId::fromBytes(call.data);
+                if(not replay.searches.find(id))
+                    replay.searches.insert(id, new PeerIdSet);
+
+                uint16_t port;
+                memcpy(&port, call.data + 20, 2);
+                dht_search(call.data, port, call.data[22] == 6 ? AF_INET6 : AF_INET,
+                           replayCallback, nullptr);
+                searches++;
+            }
+            break;
+
+        case CAPTURE_PING:
+            dht_ping_node((sockaddr *) &ss, salen);
+            others++;
+            break;
+
+        case CAPTURE_INSERT:
+            if(call.datalen == 20)
+                dht_insert_node(call.data, (sockaddr *) &ss, salen);
+            others++;
+            break;
+        }
+
+        if(replay.nextRandom != replay.randoms.size() or replay.nextBlocked != replay.blocked.size())
+            replay.diverged++;
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - wallStart).count();
+    double recorded = (call.time - firstTime) / 1e9;
+
+    if(rc < 0)
+        printf("The capture is truncated, replayed up to the last complete record\n");
+
+    printf("%zu datagrams, %zu timer calls, %llu searches, %llu pings and inserts\n",
+           datagramCalls.ns.size(), timerCalls.ns.size(),
+           (unsigned long long) searches, (unsigned long long) others);
+    printf("Replayed %.1f s of traffic in %.2f s, %.0f datagrams/s\n",
+           recorded, seconds, datagramCalls.ns.size() / std::max(seconds, 1e-9));
+
+    printf("\n%-22s %10s %10s %9s %9s %9s\n", "", "calls", "total [s]", "p50 [us]", "p99 [us]", "max [us]");
+    datagramCalls.print("dht_periodic datagram");
+    timerCalls.print("dht_periodic timer");
+    printf("%-22s %10llu %10.3f\n", "callback", (unsigned long long) replay.callbacks,
+           std::chrono::duration<double>(replay.callbackTime).count());
+
+    printf("\nSent %llu datagrams, %llu bytes, checksum %016llx\n",
+           (unsigned long long) replay.sent, (unsigned long long) replay.sentBytes,
+           (unsigned long long) replay.checksum);
+    printf("Searches found %llu peers\n", (unsigned long long) replay.values);
+
+    if(replay.diverged > 0) {
+        printf("The replay diverged from the recording in %llu calls, dht.c doesn't behave "
+               "like the recorded build\n", (unsigned long long) replay.diverged);
+    }
+
+    dht_uninit();
+    replay.searches.forEach([](PeerIdSet *s) { delete s; });
+    return 0;
+}
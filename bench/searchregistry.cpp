@@ -0,0 +1,103 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Cost of finding the search for a DHT callback, for a growing number
+ * of active searches. Compares the registry with a linear scan over
+ * heap allocated hashes, which is what the callback used to do.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "searchregistry.h"
+
+
+struct Search
+{
+    std::string hash;       /* Heap allocated copy, like QByteArray */
+};
+
+static double nsPerLookup(std::chrono::steady_clock::time_point start, long lookups)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / lookups;
+}
+
+int main(void)
+{
+    std::mt19937_64 rng(42);
+    const long lookups = 1000000;
+
+    printf("%10s %14s %14s\n", "searches", "registry [ns]", "linear [ns]");
+
+    for(int n = 10; n <= 100000; n *= 10) {
+        std::vector<NodeId> ids(n);
+        std::vector<Search *> list;
+        SearchRegistry<Search> registry;
+
+        for(auto &id : ids) {
+            for(auto &b : id.data)
+                b = rng();
+
+            auto s = new Search;
+            s->hash.assign((char *) id.data, NodeId::size);
+            list.push_back(s);
+            registry.insert(id, s);
+        }
+
+        /* Callbacks for random active searches */
+        std::vector<int> order(lookups);
+        for(auto &o : order)
+            o = rng() % n;
+
+        size_t found = 0;
+        auto start = std::chrono::steady_clock::now();
+        for(long i=0; i<lookups; i++) {
+            found += registry.find(ids[order[i]]) != nullptr;
+        }
+        double registryNs = nsPerLookup(start, lookups);
+
+        /* The linear scan is too slow for the full count with many searches */
+        long linearLookups = std::max(1000L, lookups / n * 10);
+        start = std::chrono::steady_clock::now();
+        for(long i=0; i<linearLookups; i++) {
+            std::string key((char *) ids[order[i]].data, NodeId::size);
+            for(auto s : list) {
+                if(s->hash == key) {
+                    found++;
+                    break;
+                }
+            }
+        }
+        double linearNs = nsPerLookup(start, linearLookups);
+
+        printf("%10d %14.1f %14.1f\n", n, registryNs, linearNs);
+
+        for(auto s : list)
+            delete s;
+
+        if(found == 0)
+            return 1;
+    }
+
+    return 0;
+}
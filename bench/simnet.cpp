@@ -0,0 +1,533 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runs the search engine against a simulated DHT in the same process.
+ *
+ * dht.c's sendto() calls are redirected to the simulation, which answers
+ * ping, find_node and get_peers for thousands of virtual nodes with a
+ * configurable latency and loss, and delivers the replies with
+ * DhtEngine::deliver(). Like a real routing table, every virtual node
+ * knows a fixed set of 8 random nodes in each subtree of the keyspace,
+ * so lookups take several hops. The swarms are stored on the 8 nodes
+ * closest to their info hash.
+ *
+ * Reports lookups per second and percentiles of the time to the first
+ * peer and to the completion of a search.
+ *
+ * The virtual nodes only have IPv4 addresses. With --ipv6 the engine
+ * also opens an IPv6 socket, whose routing table stays empty, so
+ * dht_search() completes that family immediately. The run fails if a
+ * search is reported as completed before its IPv4 lookup finished.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <map>
+#include <queue>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QSettings>
+#include <QTemporaryDir>
+#include <QTimer>
+
+#include "dhtengine.h"
+#include "dhtinternal.h"
+#include "dht/dht.h"
+
+
+/* Nodes returned per reply, as in the real DHT */
+static const int nodesPerReply = 8;
+
+struct VirtualNode
+{
+    NodeId id;
+    sockaddr_in addr;
+};
+
+struct Packet
+{
+    qint64 due;                 /* Delivery time in ms */
+    quint64 seq;                /* Keeps the order of packets due at the same time */
+    std::string data;
+    sockaddr_in from;           /* Virtual node that sent the reply */
+
+    bool operator>(const Packet &other) const
+    {
+        return due != other.due ? due > other.due : seq > other.seq;
+    }
+};
+
+/**
+ * Flat view of a bencoded message. Collects the byte strings of all
+ * dictionary keys, nested dictionaries included.
+ */
+static const char *scan(const char *p, const char *end, std::map<std::string, std::string> &out,
+                        const std::string &key = std::string())
+{
+    if(p >= end)
+        return nullptr;
+
+    if(*p == 'i') {
+        const char *e = (const char *) memchr(p, 'e', end - p);
+        return e ? e + 1 : nullptr;
+    }
+
+    if(*p == 'l' or *p == 'd') {
+        bool dict = *p == 'd';
+        p++;
+        while(p and p < end and *p != 'e') {
+            if(dict) {
+                const char *colon = (const char *) memchr(p, ':', end - p);
+                if(not colon)
+                    return nullptr;
+                size_t len = strtoul(p, nullptr, 10);
+                if(colon + 1 + len > end)
+                    return nullptr;
+                std::string k(colon + 1, len);
+                p = scan(colon + 1 + len, end, out, k);
+            }
+            else {
+                p = scan(p, end, out);
+            }
+        }
+        return p and p < end ? p + 1 : nullptr;
+    }
+
+    const char *colon = (const char *) memchr(p, ':', end - p);
+    if(not colon)
+        return nullptr;
+    size_t len = strtoul(p, nullptr, 10);
+    if(colon + 1 + len > end)
+        return nullptr;
+    if(not key.empty())
+        out[key] = std::string(colon + 1, len);
+    return colon + 1 + len;
+}
+
+static std::string bstring(const std::string &s)
+{
+    return std::to_string(s.size()) + ":" + s;
+}
+
+static int commonPrefix(const NodeId &a, const NodeId &b)
+{
+    for(int i=0; i<NodeId::size; i++) {
+        unsigned char x = a.data[i] ^ b.data[i];
+        if(x)
+            return 8 * i + __builtin_clz(x) - 24;
+    }
+    return 8 * NodeId::size;
+}
+
+/* First and last ID with the first bits of target */
+static void prefixRange(const NodeId &target, int bits, NodeId &lo, NodeId &hi)
+{
+    for(int i=0; i<NodeId::size; i++) {
+        int keep = std::min(8, std::max(0, bits - 8 * i));
+        unsigned char mask = keep ? 0xff << (8 - keep) : 0;
+        lo.data[i] = target.data[i] & mask;
+        hi.data[i] = target.data[i] | ~mask;
+    }
+}
+
+class SimNetwork
+{
+public:
+    SimNetwork(DhtEngine *engine, int numNodes, int swarms, int peers,
+               int latency, int jitter, double loss, quint64 seed) :
+        engine(engine), latency(latency), jitter(jitter), loss(loss), rng(seed), seq(0)
+    {
+        nodes.resize(numNodes);
+        for(int i=0; i<numNodes; i++) {
+            for(auto &b : nodes[i].id.data)
+                b = rng();
+        }
+        std::sort(nodes.begin(), nodes.end(), [](const VirtualNode &a, const VirtualNode &b) {
+            return a.id < b.id;
+        });
+
+        /* Addresses in 10.0.0.0/8, dht.c rejects loopback addresses */
+        for(int i=0; i<numNodes; i++) {
+            memset(&nodes[i].addr, 0, sizeof(sockaddr_in));
+            nodes[i].addr.sin_family = AF_INET;
+            nodes[i].addr.sin_port = htons(6881);
+            nodes[i].addr.sin_addr.s_addr = htonl(0x0a000000 + i + 1);
+        }
+
+        for(int i=0; i<swarms; i++) {
+            NodeId hash;
+            for(auto &b : hash.data)
+                b = rng();
+            std::string values;
+            for(int j=0; j<peers; j++) {
+                char peer[6];
+                for(auto &c : peer)
+                    c = rng();
+                values += bstring(std::string(peer, 6));
+            }
+            auto key = std::string((const char *) hash.data, NodeId::size);
+            swarmValues[key] = values;
+            for(int n : closest(hash, nodesPerReply))
+                holders[n].push_back(key);
+            hashes.push_back(hash);
+        }
+
+        timer.setSingleShot(true);
+        QObject::connect(&timer, &QTimer::timeout, [this]() { deliverDue(); });
+        clock.start();
+    }
+
+    const std::vector<NodeId> &swarmHashes() const { return hashes; }
+    const VirtualNode &node(int i) const { return nodes[i]; }
+
+    /**
+     * Called by dht.c instead of sendto(). The answer is queued and
+     * delivered later, never from within dht_periodic.
+     */
+    ssize_t send(const void *buf, size_t len, const sockaddr *to)
+    {
+        if(to->sa_family != AF_INET)
+            return len;
+
+        auto sin = (const sockaddr_in *) to;
+        int index = ntohl(sin->sin_addr.s_addr) - 0x0a000000 - 1;
+        if(index < 0 or index >= (int) nodes.size())
+            return len;
+
+        std::uniform_real_distribution<double> chance(0, 1);
+        if(chance(rng) < loss)
+            return len;
+
+        std::map<std::string, std::string> msg;
+        auto data = (const char *) buf;
+        scan(data, data + len, msg);
+        if(msg["y"] != "q")
+            return len;
+
+        std::string reply = answer(index, msg);
+        if(reply.empty() or chance(rng) < loss)
+            return len;
+
+        std::uniform_int_distribution<int> delay(-jitter, jitter);
+        Packet p;
+        p.due = clock.elapsed() + std::max(0, latency + delay(rng));
+        p.seq = seq++;
+        p.data = reply;
+        p.from = nodes[index].addr;
+        queue.push(p);
+        schedule();
+        return len;
+    }
+
+private:
+    /* Indices of the nodes that share at least bits prefix bits with target */
+    void prefixNodes(const NodeId &target, int bits, int &first, int &last)
+    {
+        NodeId lo, hi;
+        prefixRange(target, bits, lo, hi);
+        first = std::lower_bound(nodes.begin(), nodes.end(), lo,
+                                 [](const VirtualNode &n, const NodeId &id) { return n.id < id; })
+                - nodes.begin();
+        last = std::upper_bound(nodes.begin(), nodes.end(), hi,
+                                [](const NodeId &id, const VirtualNode &n) { return id < n.id; })
+               - nodes.begin();
+    }
+
+    void sortByDistance(std::vector<int> &result, const NodeId &target)
+    {
+        std::sort(result.begin(), result.end(), [&](int a, int b) {
+            for(int i=0; i<NodeId::size; i++) {
+                unsigned char x = nodes[a].id.data[i] ^ target.data[i];
+                unsigned char y = nodes[b].id.data[i] ^ target.data[i];
+                if(x != y)
+                    return x < y;
+            }
+            return false;
+        });
+        result.erase(std::unique(result.begin(), result.end()), result.end());
+    }
+
+    /* Indices of the count nodes closest to target */
+    std::vector<int> closest(const NodeId &target, int count)
+    {
+        std::vector<int> result;
+        for(int bits = 8 * NodeId::size; bits >= 0; bits--) {
+            int first, last;
+            prefixNodes(target, bits, first, last);
+            if(last - first >= count or bits == 0) {
+                for(int i=first; i<last; i++)
+                    result.push_back(i);
+                break;
+            }
+        }
+
+        sortByDistance(result, target);
+        if((int) result.size() > count)
+            result.resize(count);
+        return result;
+    }
+
+    /**
+     * Nodes that virtual node index knows closer to target. These are 8
+     * fixed random nodes of the subtree that contains target but not the
+     * node itself, or the closest nodes if the node is the closest one.
+     */
+    std::vector<int> known(int index, const NodeId &target)
+    {
+        int bits = commonPrefix(nodes[index].id, target) + 1;
+        if(bits > 8 * NodeId::size)
+            return closest(target, nodesPerReply);
+
+        int first, last;
+        prefixNodes(target, bits, first, last);
+        if(last == first)
+            return closest(target, nodesPerReply);
+
+        std::vector<int> result;
+        for(int k=0; k<nodesPerReply; k++) {
+            quint64 h = (quint64(index) << 16 | bits << 8 | k) * 0x9e3779b97f4a7c15ULL;
+            result.push_back(first + (h >> 32) % (last - first));
+        }
+        sortByDistance(result, target);
+        return result;
+    }
+
+    std::string answer(int index, std::map<std::string, std::string> &msg)
+    {
+        const VirtualNode &self = nodes[index];
+        std::string q = msg["q"];
+        std::string body = "2:id" + bstring(std::string((const char *) self.id.data, NodeId::size));
+
+        std::string target = q == "find_node" ? msg["target"] : msg["info_hash"];
+        if(q == "find_node" or q == "get_peers") {
+            if(target.size() != NodeId::size)
+                return std::string();
+            auto t = NodeId::fromBytes(target.data());
+
+            std::string compact;
+            for(int n : known(index, t)) {
+                if(n == index)
+                    continue;
+                compact.append((const char *) nodes[n].id.data, NodeId::size);
+                compact.append((const char *) &nodes[n].addr.sin_addr, 4);
+                compact.append((const char *) &nodes[n].addr.sin_port, 2);
+            }
+            body += "5:nodes" + bstring(compact);
+
+            if(q == "get_peers") {
+                body += "5:token4:sim!";
+                auto &held = holders[index];
+                if(std::find(held.begin(), held.end(), target) != held.end())
+                    body += "6:valuesl" + swarmValues[target] + "e";
+            }
+        }
+        else if(q != "ping" and q != "announce_peer") {
+            return std::string();
+        }
+
+        return "d1:rd" + body + "e1:t" + bstring(msg["t"]) + "1:y1:re";
+    }
+
+    void schedule()
+    {
+        qint64 wait = std::max<qint64>(0, queue.top().due - clock.elapsed());
+        if(not timer.isActive() or timer.remainingTime() > wait)
+            timer.start(wait);
+    }
+
+    void deliverDue()
+    {
+        qint64 now = clock.elapsed();
+        while(not queue.empty() and queue.top().due <= now) {
+            Packet p = queue.top();
+            queue.pop();
+            engine->deliver(p.data.data(), p.data.size(), (const sockaddr *) &p.from, sizeof(p.from));
+        }
+        if(not queue.empty())
+            schedule();
+    }
+
+    DhtEngine *engine;
+    std::vector<VirtualNode> nodes;         /* Sorted by ID */
+    std::vector<NodeId> hashes;
+    std::unordered_map<std::string, std::string> swarmValues;   /* Bencoded peers by hash */
+    std::unordered_map<int, std::vector<std::string>> holders;  /* Hashes stored on a node */
+    int latency;
+    int jitter;
+    double loss;
+    std::mt19937_64 rng;
+    std::priority_queue<Packet, std::vector<Packet>, std::greater<Packet>> queue;
+    quint64 seq;
+    QTimer timer;
+    QElapsedTimer clock;
+};
+
+static SimNetwork *network = nullptr;
+
+static ssize_t simSend(int, const void *buf, size_t len, int, const sockaddr *to, socklen_t)
+{
+    return network->send(buf, len, to);
+}
+
+static double percentile(std::vector<double> v, double p)
+{
+    if(v.empty())
+        return 0;
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, size_t(p * v.size()))];
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Search benchmark against a simulated DHT");
+    parser.addHelpOption();
+    parser.addOption(QCommandLineOption("nodes", "Number of virtual nodes.", "n", "5000"));
+    parser.addOption(QCommandLineOption("swarms", "Number of hashes to search.", "n", "500"));
+    parser.addOption(QCommandLineOption("peers", "Peers per swarm.", "n", "50"));
+    parser.addOption(QCommandLineOption("latency", "One-way latency in ms.", "ms", "20"));
+    parser.addOption(QCommandLineOption("jitter", "Latency jitter in ms.", "ms", "10"));
+    parser.addOption(QCommandLineOption("loss", "Packet loss probability.", "p", "0.02"));
+    parser.addOption(QCommandLineOption("concurrency", "Searches in flight.", "n", "64"));
+    parser.addOption(QCommandLineOption("seed", "Seed of the simulation.", "n", "1"));
+    parser.addOption(QCommandLineOption("ipv6", "Also search on an empty IPv6 routing table."));
+    parser.process(app);
+
+    /* Configuration that doesn't touch the user's files */
+    QTemporaryDir dir;
+    QString config = dir.path() + "/sim.conf";
+    {
+        QSettings settings(config, QSettings::IniFormat);
+        settings.setValue("port", 0);
+        settings.setValue("IPv6", parser.isSet("ipv6") ? 1 : 0);
+        settings.setValue("rateLimit", 0);
+        settings.setValue("nodes", QStringList());
+    }
+
+    DhtEngine engine;
+    engine.setConfigFile(config);
+    SimNetwork sim(&engine, parser.value("nodes").toInt(), parser.value("swarms").toInt(),
+                   parser.value("peers").toInt(), parser.value("latency").toInt(),
+                   parser.value("jitter").toInt(), parser.value("loss").toDouble(),
+                   parser.value("seed").toULongLong());
+    network = &sim;
+
+    /* Replaces the engine's send queue, the simulation has no send buffer */
+    if(not engine.init())
+        return 1;
+    dht_internal_set_send_function(simSend);
+
+    /* Bootstrap from a few virtual nodes */
+    for(int i=0; i<64; i++) {
+        auto &n = sim.node(i * 7919 % parser.value("nodes").toInt());
+        dht_ping_node((const sockaddr *) &n.addr, sizeof(n.addr));
+    }
+
+    const int concurrency = parser.value("concurrency").toInt();
+    const auto &hashes = sim.swarmHashes();
+    size_t next = 0, done = 0, withPeers = 0, early = 0;
+    std::vector<double> firstPeer, completion;
+    QHash<QByteArray, qint64> started;
+    QSet<QByteArray> seen;
+    QElapsedTimer clock, runtime;
+    clock.start();
+
+    std::function<void()> refill = [&]() {
+        while(next < hashes.size() and started.size() < concurrency) {
+            const NodeId &id = hashes[next];
+            SearchInfo *info = engine.startSearch(id, &app);
+            if(not info)
+                break;
+            next++;
+
+            /* The IPv4 lookup can't have finished yet */
+            if(info->completed)
+                early++;
+
+            started[QByteArray((const char *) id.data, NodeId::size)] = clock.elapsed();
+        }
+    };
+
+    QObject::connect(&engine, &DhtEngine::searchesChanged, [&](const QVector<SearchChange> &changes) {
+        for(auto &change : changes) {
+            QByteArray key((const char *) change.id.data, NodeId::size);
+            if(not started.contains(key))
+                continue;
+
+            if(not change.peers.empty() and not seen.contains(key)) {
+                seen.insert(key);
+                firstPeer.push_back(clock.elapsed() - started[key]);
+            }
+
+            if(change.completed) {
+                completion.push_back(clock.elapsed() - started.take(key));
+                done++;
+                withPeers += engine.findSearchInfo(change.id)->results.size() > 0;
+                engine.releaseSearch(change.id, &app);
+            }
+        }
+
+        refill();
+        if(done == hashes.size())
+            app.quit();
+    });
+
+    /* Let the routing table fill before measuring */
+    QTimer warmup;
+    QObject::connect(&warmup, &QTimer::timeout, [&]() {
+        int good4, good6;
+        engine.getNodeCounts(good4, good6);
+        if(good4 < 32 and clock.elapsed() < 30000)
+            return;
+        warmup.stop();
+        printf("Warm-up done after %.1f s with %d good nodes\n", clock.elapsed() / 1000.0, good4);
+        runtime.start();
+        refill();
+    });
+    warmup.start(100);
+
+    app.exec();
+    dht_internal_set_send_function(nullptr);
+
+    double seconds = runtime.elapsed() / 1000.0;
+    printf("%zu lookups in %.1f s, %.1f lookups/s, %.1f%% found peers\n",
+           done, seconds, done / seconds, 100.0 * withPeers / std::max<size_t>(done, 1));
+    printf("%-22s %8s %8s %8s\n", "", "p50 [ms]", "p90 [ms]", "p99 [ms]");
+    printf("%-22s %8.0f %8.0f %8.0f\n", "time to first peer",
+           percentile(firstPeer, 0.5), percentile(firstPeer, 0.9), percentile(firstPeer, 0.99));
+    printf("%-22s %8.0f %8.0f %8.0f\n", "completion",
+           percentile(completion, 0.5), percentile(completion, 0.9), percentile(completion, 0.99));
+
+    if(early > 0) {
+        printf("%zu searches completed before their lookup finished\n", early);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Throughput of the callbacks dht.c uses for tokens and random numbers.
+ * Compares dht_hash with the OpenSSL SHA_CTX code it used before, and
+ * the pooled dht_random_bytes with a read from /dev/urandom per call.
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <openssl/sha.h>
+
+#include "dht/dht.h"
+#include "sha1.h"
+
+
+static const long tokens = 2000000;
+static const long randomCalls = 200000;
+
+/* Previous implementation of dht_hash */
+static void opensslHash(void *hash_return, int hash_size,
+                        const void *v1, int len1,
+                        const void *v2, int len2,
+                        const void *v3, int len3)
+{
+    SHA_CTX c;
+    unsigned char md[SHA_DIGEST_LENGTH] = {0};
+
+    SHA1_Init(&c);
+    SHA1_Update(&c, v1, len1);
+    SHA1_Update(&c, v2, len2);
+    SHA1_Update(&c, v3, len3);
+    SHA1_Final(md, &c);
+
+    memcpy(hash_return, md, hash_size);
+}
+
+/* Previous implementation of dht_random_bytes */
+static int urandomBytes(void *buf, size_t size)
+{
+    int fd = open("/dev/urandom", O_RDONLY);
+    if(fd < 0)
+        return -1;
+
+    int rc = read(fd, buf, size);
+    close(fd);
+    return rc;
+}
+
+static double perSecond(std::chrono::steady_clock::time_point start, long n)
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return n / std::chrono::duration<double>(elapsed).count();
+}
+
+/*
+ * Tokens like dht.c makes them: an 8 byte secret, the IPv4 or IPv6
+ * address and the port of the requester.
+ */
+template<typename F>
+static double tokenRate(F hash, int addrLen)
+{
+    unsigned char secret[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    unsigned char addr[16] = {};
+    unsigned char port[2] = {0x1a, 0xe1};
+    unsigned char token[8];
+    unsigned sum = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    for(long i=0; i<tokens; i++) {
+        memcpy(addr, &i, sizeof(i));
+        hash(token, sizeof(token), secret, sizeof(secret), addr, addrLen, port, 2);
+        sum += token[0];
+    }
+    double rate = perSecond(start, tokens);
+
+    if(sum == 1)
+        printf(" ");    /* Keep the loop */
+    return rate;
+}
+
+int main(void)
+{
+    printf("%-22s %16s %16s\n", "token hash", "IPv4 [tokens/s]", "IPv6 [tokens/s]");
+    printf("%-22s %16.0f %16.0f\n", "openssl SHA_CTX",
+           tokenRate(opensslHash, 4), tokenRate(opensslHash, 16));
+
+    if(sha1_accelerated()) {
+        printf("%-22s %16.0f %16.0f\n", "dht_hash sha-ni",
+               tokenRate(dht_hash, 4), tokenRate(dht_hash, 16));
+    }
+    else {
+        printf("CPU without SHA extensions, dht_hash uses OpenSSL\n");
+    }
+
+    unsigned char buf[8];
+    printf("\n%-22s %16s\n", "random bytes", "8 bytes [calls/s]");
+
+    auto start = std::chrono::steady_clock::now();
+    for(long i=0; i<randomCalls; i++)
+        urandomBytes(buf, sizeof(buf));
+    printf("%-22s %16.0f\n", "open /dev/urandom", perSecond(start, randomCalls));
+
+    start = std::chrono::steady_clock::now();
+    for(long i=0; i<randomCalls; i++)
+        dht_random_bytes(buf, sizeof(buf));
+    printf("%-22s %16.0f\n", "dht_random_bytes", perSecond(start, randomCalls));
+
+    return 0;
+}
@@ -0,0 +1,331 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "admission.h"
+
+int dht_random_bytes(void *buf, size_t size);
+
+
+/*
+ * Binary trie over the address bits. Nodes live in one array and refer
+ * to their children by index, 0 means no child.
+ */
+struct trie_node {
+    int32_t child[2];
+    int32_t blocked;            /* A prefix ends at this node */
+};
+
+struct trie {
+    struct trie_node *nodes;    /* nodes[0] is the root */
+    int32_t count;
+    int32_t capacity;
+};
+
+static struct trie trie4, trie6;
+
+static int32_t trie_new_node(struct trie *t)
+{
+    if(t->count == t->capacity) {
+        int32_t capacity = t->capacity ? 2 * t->capacity : 64;
+        struct trie_node *nodes = realloc(t->nodes, capacity * sizeof(*nodes));
+        if(!nodes)
+            return -1;
+        t->nodes = nodes;
+        t->capacity = capacity;
+    }
+
+    memset(&t->nodes[t->count], 0, sizeof(t->nodes[0]));
+    return t->count++;
+}
+
+static int bit(const unsigned char *addr, int i)
+{
+    return (addr[i / 8] >> (7 - i % 8)) & 1;
+}
+
+static int trie_insert(struct trie *t, const unsigned char *addr, int bits)
+{
+    int32_t n;
+    int i;
+
+    if(t->count == 0 && trie_new_node(t) < 0)
+        return -1;
+
+    n = 0;
+    for(i = 0; i < bits; i++) {
+        int32_t next;
+
+        /* A shorter prefix already covers this one */
+        if(t->nodes[n].blocked)
+            return 0;
+
+        next = t->nodes[n].child[bit(addr, i)];
+        if(next == 0) {
+            next = trie_new_node(t);
+            if(next < 0)
+                return -1;
+            t->nodes[n].child[bit(addr, i)] = next;
+        }
+        n = next;
+    }
+
+    /* Longer prefixes below are unreachable now, their nodes stay unused */
+    t->nodes[n].blocked = 1;
+    t->nodes[n].child[0] = 0;
+    t->nodes[n].child[1] = 0;
+    return 0;
+}
+
+static int trie_lookup(const struct trie *t, const unsigned char *addr, int bits)
+{
+    int32_t n = 0;
+    int i;
+
+    if(t->count == 0)
+        return 0;
+
+    for(i = 0; i < bits; i++) {
+        if(t->nodes[n].blocked)
+            return 1;
+        n = t->nodes[n].child[bit(addr, i)];
+        if(n == 0)
+            return 0;
+    }
+    return t->nodes[n].blocked;
+}
+
+int admission_block(const char *cidr)
+{
+    char buf[INET6_ADDRSTRLEN + 8];
+    unsigned char addr[16];
+    char *slash, *end;
+    long bits;
+    int v6;
+
+    if(strlen(cidr) >= sizeof(buf))
+        return -1;
+    strcpy(buf, cidr);
+
+    v6 = strchr(buf, ':') != NULL;
+    slash = strchr(buf, '/');
+    if(slash) {
+        *slash = '\0';
+        bits = strtol(slash + 1, &end, 10);
+        if(*end != '\0' || bits < 0 || bits > (v6 ? 128 : 32))
+            return -1;
+    }
+    else {
+        bits = v6 ? 128 : 32;
+    }
+
+    if(inet_pton(v6 ? AF_INET6 : AF_INET, buf, addr) != 1)
+        return -1;
+
+    return trie_insert(v6 ? &trie6 : &trie4, addr, bits);
+}
+
+int admission_load_blocklist(const char *path)
+{
+    char line[256];
+    int count = 0, lineno = 0;
+    FILE *f = fopen(path, "r");
+
+    if(!f)
+        return -1;
+
+    while(fgets(line, sizeof(line), f)) {
+        char *p = line, *e;
+        lineno++;
+
+        e = strchr(p, '#');
+        if(e)
+            *e = '\0';
+        while(*p == ' ' || *p == '\t')
+            p++;
+        e = p + strlen(p);
+        while(e > p && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\n' || e[-1] == '\r'))
+            *--e = '\0';
+        if(*p == '\0')
+            continue;
+
+        if(admission_block(p) < 0)
+            fprintf(stderr, "%s:%d: invalid prefix\n", path, lineno);
+        else
+            count++;
+    }
+
+    fclose(f);
+    return count;
+}
+
+
+/*
+ * Token buckets in a set-associative table. A source hashes to one set
+ * and takes the matching way, a free way, or the way that was idle for
+ * the longest time. Buckets idle for longer than IDLE_MS are free.
+ */
+#define RATE_SETS 4096
+#define RATE_WAYS 4
+#define IDLE_MS 60000
+
+struct rate_entry {
+    unsigned char key[16];      /* IPv4 mapped to IPv6, IPv6 cut to /64 */
+    uint32_t last;              /* Last refill in ms, 0 if unused */
+    uint32_t tokens;            /* Thousandths of a packet */
+};
+
+static struct rate_entry rate_table[RATE_SETS][RATE_WAYS];
+static uint64_t rate_seed;
+static uint32_t rate_per_second = 0;
+static uint32_t rate_burst = 0;
+static struct admission_stats stats;
+
+void admission_set_rate(unsigned rate, unsigned burst)
+{
+    rate_per_second = rate;
+    rate_burst = burst > 0 ? burst : 1;
+    memset(rate_table, 0, sizeof(rate_table));
+
+    /* A random seed keeps sources from choosing colliding addresses */
+    if(dht_random_bytes(&rate_seed, sizeof(rate_seed)) < 0)
+        rate_seed = 0x9e3779b97f4a7c15ULL;
+}
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    uint32_t ms;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    ms = (uint32_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    return ms ? ms : 1;
+}
+
+static size_t rate_hash(const unsigned char key[16])
+{
+    uint64_t a, b, h;
+
+    memcpy(&a, key, 8);
+    memcpy(&b, key + 8, 8);
+    h = (a ^ rate_seed) * 0x9e3779b97f4a7c15ULL ^ b;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return h % RATE_SETS;
+}
+
+/* Returns 1 if the source is over its rate */
+static int rate_limited(const unsigned char key[16])
+{
+    struct rate_entry *set = rate_table[rate_hash(key)];
+    struct rate_entry *e = NULL;
+    uint32_t now = now_ms();
+    uint64_t tokens;
+    int i;
+
+    for(i = 0; i < RATE_WAYS; i++) {
+        if(set[i].last != 0 && memcmp(set[i].key, key, 16) == 0) {
+            e = &set[i];
+            break;
+        }
+    }
+
+    if(!e) {
+        e = &set[0];
+        for(i = 0; i < RATE_WAYS; i++) {
+            if(set[i].last == 0 || now - set[i].last > IDLE_MS) {
+                e = &set[i];
+                break;
+            }
+            if(now - set[i].last > now - e->last)
+                e = &set[i];
+        }
+        memcpy(e->key, key, 16);
+        e->last = now;
+        e->tokens = rate_burst * 1000;
+    }
+
+    tokens = e->tokens + (uint64_t) (now - e->last) * rate_per_second;
+    if(tokens > rate_burst * 1000ULL)
+        tokens = rate_burst * 1000ULL;
+    e->last = now;
+
+    if(tokens < 1000) {
+        e->tokens = tokens;
+        return 1;
+    }
+    e->tokens = tokens - 1000;
+    return 0;
+}
+
+int admission_blocked(const struct sockaddr *sa, int salen)
+{
+    if(sa->sa_family == AF_INET && salen >= (int) sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
+        return trie_lookup(&trie4, (const unsigned char *) &sin->sin_addr, 32) != 0;
+    }
+    if(sa->sa_family == AF_INET6 && salen >= (int) sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+        return trie_lookup(&trie6, (const unsigned char *) &sin6->sin6_addr, 128) != 0;
+    }
+    return 0;
+}
+
+int admission_check(const struct sockaddr *sa, int salen)
+{
+    unsigned char key[16];
+
+    if(sa->sa_family == AF_INET && salen >= (int) sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
+        memset(key, 0, 10);
+        key[10] = key[11] = 0xff;
+        memcpy(key + 12, &sin->sin_addr, 4);
+    }
+    else if(sa->sa_family == AF_INET6 && salen >= (int) sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+        memcpy(key, &sin6->sin6_addr, 8);
+        memset(key + 8, 0, 8);
+    }
+    else {
+        return 0;
+    }
+
+    if(admission_blocked(sa, salen)) {
+        stats.blocked++;
+        return 1;
+    }
+
+    if(rate_per_second > 0 && rate_limited(key)) {
+        stats.limited++;
+        return 1;
+    }
+
+    stats.admitted++;
+    return 0;
+}
+
+void admission_get_stats(struct admission_stats *s)
+{
+    *s = stats;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Admission filter for incoming packets. Sources are dropped if they are
+ * in the CIDR blocklist or exceed the per-source packet rate. The engine
+ * checks every received datagram before passing it to dht.c.
+ *
+ * dht_blacklisted() only looks up the blocklist. dht.c also calls it for
+ * the packets it sends and the nodes it learns, which must not use up
+ * the rate of a source or be counted as dropped.
+ *
+ * Checking a source doesn't allocate. The blocklist lookup walks at most
+ * as many trie nodes as the address has bits, the rate limiter probes
+ * a single set of a fixed-size table. IPv6 sources are rate limited
+ * per /64. All functions must be called from the thread running dht.c.
+ */
+
+struct admission_stats {
+    uint64_t admitted;          /* Packets that passed */
+    uint64_t blocked;           /* Packets from blocked prefixes */
+    uint64_t limited;           /* Packets over the rate limit */
+};
+
+/* Block a prefix like "192.0.2.0/24" or "2001:db8::/32". Returns 0 on
+ * success and -1 if the prefix can't be parsed. */
+int admission_block(const char *cidr);
+
+/* Add the prefixes in a file, one per line, # starts a comment. Returns
+ * the number of prefixes or -1 if the file can't be read. */
+int admission_load_blocklist(const char *path);
+
+/* Allow rate packets per second and source with bursts of up to burst
+ * packets. A rate of 0 disables the limiter. */
+void admission_set_rate(unsigned rate, unsigned burst);
+
+/* Returns 1 if sa is in the blocklist. Doesn't change the statistics. */
+int admission_blocked(const struct sockaddr *sa, int salen);
+
+/* Returns 1 if a packet received from sa should be dropped. Takes a
+ * token from the source's rate limit and counts the packet. */
+int admission_check(const struct sockaddr *sa, int salen);
+
+void admission_get_stats(struct admission_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,289 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QDebug>
+#include "batchsearch.h"
+#include "codec.h"
+
+
+/* Searches are started once this many good nodes are known */
+static const int minGoodNodes = 16;
+
+/* Start anyway after this many milliseconds */
+static const int maxWarmup = 60000;
+
+/* Bytes read from the input at once */
+static const int readSize = 64 * 1024;
+
+
+BatchSearch::BatchSearch(DhtEngine *engine, int concurrency, QObject *parent) :
+    QObject(parent),
+    engine(engine),
+    concurrency(concurrency),
+    inputFd(-1),
+    inputFlags(0),
+    inputNotifier(nullptr),
+    bufferPos(0),
+    inputDone(false),
+    lineNumber(0),
+    retryScheduled(false),
+    warmupTimer(nullptr),
+    done(0)
+{
+    connect(engine, &DhtEngine::searchesChanged, this, &BatchSearch::searchesChanged);
+}
+
+BatchSearch::~BatchSearch()
+{
+    output.flush();
+
+    /* stdin may be shared with other processes */
+    if(inputFd >= 0)
+        fcntl(inputFd, F_SETFL, inputFlags);
+}
+
+/**
+ * Open the list of hashes. Returns true on success.
+ */
+bool BatchSearch::open(const QString &path)
+{
+    int fd;
+    if(path == "-") {
+        fd = STDIN_FILENO;
+    }
+    else {
+        input.setFileName(path);
+        fd = input.open(QIODevice::ReadOnly) ? input.handle() : -1;
+    }
+
+    int flags = fd >= 0 ? fcntl(fd, F_GETFL) : -1;
+    if(flags < 0 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        qCritical() << "Can't open" << path;
+        return false;
+    }
+    inputFd = fd;
+    inputFlags = flags;
+
+    /* Only pipes and terminals ever wait, see readInput() */
+    inputNotifier = new QSocketNotifier(inputFd, QSocketNotifier::Read, this);
+    inputNotifier->setEnabled(false);
+    connect(inputNotifier, &QSocketNotifier::activated, this, &BatchSearch::inputReady);
+
+    return output.open(stdout, QIODevice::WriteOnly);
+}
+
+/**
+ * Start the searches as soon as the routing table is populated
+ */
+void BatchSearch::start(void)
+{
+    warmup.start();
+    warmupTimer = new QTimer(this);
+    connect(warmupTimer, &QTimer::timeout, this, &BatchSearch::waitForNodes);
+    warmupTimer->start(1000);
+}
+
+/**
+ * Check if there are enough good nodes to start searching
+ */
+void BatchSearch::waitForNodes(void)
+{
+    int good4, good6;
+    engine->getNodeCounts(good4, good6);
+
+    if(good4 + good6 < minGoodNodes and warmup.elapsed() < maxWarmup)
+        return;
+
+    qInfo() << "Starting batch search with" << good4 + good6 << "good nodes";
+    warmupTimer->stop();
+    runtime.start();
+    refill();
+}
+
+/**
+ * Read the next valid hash. Returns false at the end of the input
+ * or if no complete line is available yet.
+ */
+bool BatchSearch::nextHash(NodeId &id)
+{
+    for(;;) {
+        int end = buffer.indexOf('\n', bufferPos);
+        if(end < 0) {
+            if(not inputDone) {
+                if(not readInput())
+                    return false;
+                continue;
+            }
+
+            /* The last line may lack the newline */
+            if(bufferPos == buffer.size())
+                return false;
+            end = buffer.size();
+        }
+
+        QByteArray line = buffer.mid(bufferPos, end - bufferPos).trimmed();
+        bufferPos = std::min(end + 1, buffer.size());
+        lineNumber++;
+
+        if(line.isEmpty())
+            continue;
+
+        if(not Codec::parseId(line, id)) {
+            qWarning() << "Ignoring invalid hash on line" << lineNumber;
+            continue;
+        }
+        return true;
+    }
+}
+
+/**
+ * Read the next chunk of the input. Returns false if there is no data
+ * right now, the notifier then calls refill() when there is.
+ */
+bool BatchSearch::readInput(void)
+{
+    buffer.remove(0, bufferPos);
+    bufferPos = 0;
+
+    int size = buffer.size();
+    buffer.resize(size + readSize);
+    ssize_t n = ::read(inputFd, buffer.data() + size, readSize);
+    buffer.resize(size + std::max<ssize_t>(n, 0));
+
+    if(n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+        inputNotifier->setEnabled(true);
+        return false;
+    }
+
+    if(n < 0 and errno != EINTR) {
+        qWarning() << "Can't read the input:" << strerror(errno);
+        inputDone = true;
+    }
+    else if(n == 0) {
+        inputDone = true;
+    }
+    return true;
+}
+
+/**
+ * The input became readable while refill() was waiting for it
+ */
+void BatchSearch::inputReady(void)
+{
+    inputNotifier->setEnabled(false);
+    if(runtime.isValid())
+        refill();
+}
+
+/**
+ * Collect the completed searches of the batch and replace them
+ */
+void BatchSearch::searchesChanged(const QVector<SearchChange> &changes)
+{
+    for(auto &change : changes) {
+        if(change.completed and inFlight.contains(change.id))
+            completed.append(change.id);
+    }
+
+    if(not completed.isEmpty())
+        refill();
+}
+
+/**
+ * Report completed searches and start new ones until
+ * the window is full again.
+ */
+void BatchSearch::refill(void)
+{
+    for(auto &id : completed) {
+        if(inFlight.remove(id)) {
+            writeResult(id);
+            engine->releaseSearch(id, this);
+            done++;
+        }
+    }
+    completed.clear();
+
+    while(inFlight.size() < concurrency) {
+        NodeId id;
+        if(not retry.isEmpty()) {
+            id = retry.takeFirst();
+        }
+        else if(not nextHash(id)) {
+            break;
+        }
+
+        if(inFlight.contains(id))
+            continue;
+
+        if(not engine->startSearch(id, this)) {
+            /* The DHT doesn't accept more searches right now */
+            retry.append(id);
+            if(not retryScheduled) {
+                retryScheduled = true;
+                QTimer::singleShot(1000, this, &BatchSearch::retryStart);
+            }
+            break;
+        }
+        inFlight.insert(id);
+    }
+    output.flush();
+
+    if(inputDone and bufferPos == buffer.size() and retry.isEmpty() and inFlight.isEmpty()) {
+        qInfo() << "Batch search finished," << done << "hashes in"
+                << runtime.elapsed() / 1000.0 << "seconds";
+        emit finished();
+    }
+}
+
+void BatchSearch::retryStart(void)
+{
+    retryScheduled = false;
+    refill();
+}
+
+/**
+ * Write a line with the hash, the number of peers and the peers
+ */
+void BatchSearch::writeResult(const NodeId &id)
+{
+    const SearchInfo *info = engine->findSearchInfo(id);
+    size_t count = info ? info->results.size() : 0;
+
+    QByteArray line;
+    Codec::appendId(line, id);
+    line.append(' ');
+    line.append(QByteArray::number((quint64) count));
+
+    if(info) {
+        const PeerTable &peers = PeerTable::global();
+        info->results.forEach([&line, &peers](uint32_t peer) {
+            line.append(' ');
+            Codec::appendEndpoint(line, peers.endpoint(peer));
+        });
+    }
+    line.append('\n');
+
+    output.write(line);
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSet>
+
+#include "dhtengine.h"
+
+
+/**
+ * Runs searches for a list of hashes read from a file or stdin.
+ * A fixed number of searches is kept in flight and the results of
+ * every hash are written to stdout as soon as its search completes.
+ *
+ * The input is read without blocking, so the engine keeps running
+ * while a pipe has no data.
+ */
+class BatchSearch : public QObject
+{
+    Q_OBJECT
+
+public:
+    BatchSearch(DhtEngine *engine, int concurrency, QObject *parent = 0);
+    ~BatchSearch();
+
+    bool open(const QString &path);     /* "-" reads from stdin */
+    void start(void);
+
+signals:
+    void finished();
+
+private slots:
+    void searchesChanged(const QVector<SearchChange> &changes);
+    void refill(void);
+    void retryStart(void);              /* Called by the retry timer */
+    void inputReady(void);              /* More input is available */
+    void waitForNodes(void);
+
+private:
+    bool nextHash(NodeId &id);          /* Read the next hash from the input */
+    bool readInput(void);               /* Append input to the buffer */
+    void writeResult(const NodeId &id);
+
+    DhtEngine *engine;
+    int concurrency;            /* Maximum number of searches in flight */
+    QFile input;
+    QFile output;
+    int inputFd;                /* Descriptor of the input, -1 if not open */
+    int inputFlags;             /* File status flags of the input before open() */
+    QSocketNotifier *inputNotifier; /* Enabled while waiting for input */
+    QByteArray buffer;          /* Input that wasn't parsed yet, from bufferPos on */
+    int bufferPos;
+    bool inputDone;             /* End of the input was reached */
+    quint64 lineNumber;
+
+    QSet<NodeId> inFlight;      /* Searches started by the batch */
+    QList<NodeId> completed;    /* Searches to report at the next refill */
+    QList<NodeId> retry;        /* Hashes dht_search() didn't accept */
+    bool retryScheduled;        /* The retry timer is running */
+
+    QTimer *warmupTimer;        /* Polls the routing table before the start */
+    QElapsedTimer warmup;
+    QElapsedTimer runtime;
+    quint64 done;               /* Number of completed hashes */
+};
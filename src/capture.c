@@ -0,0 +1,194 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "capture.h"
+
+static const char magic[8] = { 'D', 'H', 'T', 'C', 'A', 'P', '0', '1' };
+
+static FILE *file = NULL;
+static int failed = 0;
+static uint64_t start_wall;     /* Microseconds since the epoch at capture_open() */
+static uint64_t start_mono;     /* Monotonic nanoseconds at capture_open() */
+
+static uint64_t monotonic_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int capture_open(const char *path)
+{
+    unsigned char header[CAPTURE_HEADER_SIZE];
+    struct timeval tv;
+
+    capture_close();
+
+    file = fopen(path, "wb");
+    if(!file)
+        return -1;
+
+    /* Records are small, write them in large blocks */
+    setvbuf(file, NULL, _IOFBF, 1 << 20);
+    failed = 0;
+
+    gettimeofday(&tv, NULL);
+    start_wall = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+    start_mono = monotonic_ns();
+
+    memcpy(header, magic, 8);
+    memcpy(header + 8, &start_wall, 8);
+    if(fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+        fclose(file);
+        file = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+int capture_close(void)
+{
+    if(file) {
+        if(fclose(file) != 0)
+            failed = 1;
+        file = NULL;
+    }
+    return failed ? -1 : 0;
+}
+
+int capture_active(void)
+{
+    return file != NULL;
+}
+
+void capture_write(int type, const struct sockaddr *sa, int salen,
+                   const void *data, size_t len, struct timeval *now)
+{
+    unsigned char header[CAPTURE_RECORD_SIZE + 18];
+    uint64_t time;
+    uint16_t length = len;
+    size_t addrlen = 0;
+
+    if(!file)
+        return;
+
+    time = monotonic_ns() - start_mono;
+    if(now)
+        capture_clock(start_wall, time, now);
+
+    /* Store the address in compact format */
+    if(sa && sa->sa_family == AF_INET && salen >= (int) sizeof(struct sockaddr_in)) {
+        const struct sockaddr_in *sin = (const struct sockaddr_in *) sa;
+        memcpy(header + CAPTURE_RECORD_SIZE, &sin->sin_addr, 4);
+        memcpy(header + CAPTURE_RECORD_SIZE + 4, &sin->sin_port, 2);
+        addrlen = 6;
+    }
+    else if(sa && sa->sa_family == AF_INET6 && salen >= (int) sizeof(struct sockaddr_in6)) {
+        const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *) sa;
+        memcpy(header + CAPTURE_RECORD_SIZE, &sin6->sin6_addr, 16);
+        memcpy(header + CAPTURE_RECORD_SIZE + 16, &sin6->sin6_port, 2);
+        addrlen = 18;
+    }
+
+    memcpy(header, &time, 8);
+    header[8] = type;
+    header[9] = addrlen;
+    memcpy(header + 10, &length, 2);
+
+    if(fwrite(header, 1, CAPTURE_RECORD_SIZE + addrlen, file) != CAPTURE_RECORD_SIZE + addrlen ||
+       (len > 0 && fwrite(data, 1, len, file) != len)) {
+        /* Stop instead of writing a capture with holes */
+        fclose(file);
+        file = NULL;
+        failed = 1;
+    }
+}
+
+int capture_parse_header(const unsigned char *buf, size_t size, uint64_t *start)
+{
+    if(size < CAPTURE_HEADER_SIZE || memcmp(buf, magic, 8) != 0)
+        return -1;
+
+    memcpy(start, buf + 8, 8);
+    return 0;
+}
+
+int capture_parse(const unsigned char *buf, size_t size, size_t *offset,
+                  struct capture_record *rec)
+{
+    const unsigned char *p = buf + *offset;
+    size_t left = size - *offset;
+    uint16_t length;
+
+    if(left == 0)
+        return 0;
+    if(left < CAPTURE_RECORD_SIZE)
+        return -1;
+
+    memcpy(&rec->time, p, 8);
+    rec->type = p[8];
+    rec->addrlen = p[9];
+    memcpy(&length, p + 10, 2);
+    rec->datalen = length;
+
+    if(rec->addrlen != 0 && rec->addrlen != 6 && rec->addrlen != 18)
+        return -1;
+    if(left < (size_t) CAPTURE_RECORD_SIZE + rec->addrlen + rec->datalen)
+        return -1;
+
+    rec->addr = p + CAPTURE_RECORD_SIZE;
+    rec->data = rec->addr + rec->addrlen;
+    *offset += CAPTURE_RECORD_SIZE + rec->addrlen + rec->datalen;
+    return 1;
+}
+
+int capture_address(const struct capture_record *rec, struct sockaddr_storage *ss)
+{
+    memset(ss, 0, sizeof(*ss));
+
+    if(rec->addrlen == 6) {
+        struct sockaddr_in *sin = (struct sockaddr_in *) ss;
+        sin->sin_family = AF_INET;
+        memcpy(&sin->sin_addr, rec->addr, 4);
+        memcpy(&sin->sin_port, rec->addr + 4, 2);
+        return sizeof(*sin);
+    }
+    else if(rec->addrlen == 18) {
+        struct sockaddr_in6 *sin6 = (struct sockaddr_in6 *) ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, rec->addr, 16);
+        memcpy(&sin6->sin6_port, rec->addr + 16, 2);
+        return sizeof(*sin6);
+    }
+    return 0;
+}
+
+void capture_clock(uint64_t start, uint64_t time, struct timeval *tv)
+{
+    uint64_t us = start + time / 1000;
+
+    tv->tv_sec = us / 1000000;
+    tv->tv_usec = us % 1000000;
+}
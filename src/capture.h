@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Capture of all input to dht.c, for replaying a session offline.
+ *
+ * While a capture is open, dhtinternal.c records every call into dht.c:
+ * received datagrams and timer calls of dht_periodic(), searches, pings
+ * and inserted nodes. Values dht.c gets from outside during a call are
+ * recorded after it, these are the random bytes it draws and the
+ * sources dht_blacklisted() dropped. The clock dht.c sees is derived
+ * from the timestamp of the call, so feeding the records back in order
+ * reproduces the same state and the same replies.
+ *
+ * File format, host byte order:
+ *   u8[8] magic "DHTCAP01"
+ *   u64 microseconds since the epoch when the capture was opened
+ *   records:
+ *     u64 nanoseconds since the capture was opened (monotonic clock)
+ *     u8 type
+ *     u8 address length, 0, 6 (IPv4) or 18 (IPv6)
+ *     u16 data length
+ *     address in compact format
+ *     data
+ *
+ * The capture contains the token secrets of the node, don't share it.
+ */
+
+enum capture_type {
+    CAPTURE_INIT = 1,       /* data: node ID, u8[4] version, u8 flags (1 IPv4, 2 IPv6) */
+    CAPTURE_PERIODIC,       /* address: source, data: datagram, both empty for timer calls */
+    CAPTURE_SEARCH,         /* data: info hash, u16 port, u8 family (4 or 6) */
+    CAPTURE_PING,           /* address: node */
+    CAPTURE_INSERT,         /* address: node, data: node ID */
+    CAPTURE_RANDOM,         /* data: random bytes returned to dht.c */
+    CAPTURE_BLOCKED,        /* address: source, data: u32 number of the filter call */
+};
+
+#define CAPTURE_HEADER_SIZE 16
+#define CAPTURE_RECORD_SIZE 12
+
+struct capture_record {
+    uint64_t time;              /* Nanoseconds since the capture was opened */
+    int type;
+    int addrlen;
+    int datalen;
+    const unsigned char *addr;  /* Points into the parsed buffer */
+    const unsigned char *data;
+};
+
+/* Start recording to path. Returns 0 on success and -1 if the file
+ * can't be created. */
+int capture_open(const char *path);
+
+/* Stop recording. Returns -1 if a write failed, the capture is
+ * incomplete then. */
+int capture_close(void);
+
+int capture_active(void);
+
+/* Append a record. If now isn't null, it is set to the time dht.c sees
+ * during the call. Must be called from the thread running dht.c. */
+void capture_write(int type, const struct sockaddr *sa, int salen,
+                   const void *data, size_t len, struct timeval *now);
+
+/* Read the file header. Returns 0 on success and -1 if buf isn't a
+ * capture. start is set to the time the capture was opened. */
+int capture_parse_header(const unsigned char *buf, size_t size, uint64_t *start);
+
+/* Read the record at *offset and advance it. Returns 1 for a record,
+ * 0 at the end and -1 if the record is truncated. */
+int capture_parse(const unsigned char *buf, size_t size, size_t *offset,
+                  struct capture_record *rec);
+
+/* Convert the address of a record to a socket address. Returns the
+ * length of the address or 0 if the record has none. */
+int capture_address(const struct capture_record *rec, struct sockaddr_storage *ss);
+
+/* Time dht.c sees for a record with timestamp time */
+void capture_clock(uint64_t start, uint64_t time, struct timeval *tv);
+
+#ifdef __cplusplus
+}
+#endif
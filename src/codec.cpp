@@ -0,0 +1,211 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstring>
+#include <arpa/inet.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "codec.h"
+
+
+static const char digits[] = "0123456789abcdef";
+
+#ifdef __SSE2__
+/* Hex digits of 16 bytes */
+static inline void encode16(const unsigned char *in, char *out)
+{
+    const __m128i mask = _mm_set1_epi8(0x0f);
+    const __m128i nine = _mm_set1_epi8(9);
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i gap = _mm_set1_epi8('a' - '0' - 10);
+
+    __m128i v = _mm_loadu_si128((const __m128i *) in);
+    __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask);
+    __m128i lo = _mm_and_si128(v, mask);
+
+    /* Nibbles in output order, then '0' + n, plus the gap to 'a' above 9 */
+    __m128i a = _mm_unpacklo_epi8(hi, lo);
+    __m128i b = _mm_unpackhi_epi8(hi, lo);
+    a = _mm_add_epi8(_mm_add_epi8(a, zero), _mm_and_si128(_mm_cmpgt_epi8(a, nine), gap));
+    b = _mm_add_epi8(_mm_add_epi8(b, zero), _mm_and_si128(_mm_cmpgt_epi8(b, nine), gap));
+
+    _mm_storeu_si128((__m128i *) out, a);
+    _mm_storeu_si128((__m128i *) (out + 16), b);
+}
+
+/* Values of 16 hex digits, all bits set in invalid for other characters */
+static inline __m128i digitValues(__m128i c, __m128i &invalid)
+{
+    __m128i d = _mm_sub_epi8(c, _mm_set1_epi8('0'));
+    __m128i l = _mm_sub_epi8(_mm_or_si128(c, _mm_set1_epi8(0x20)), _mm_set1_epi8('a'));
+
+    /* Unsigned range checks, x <= n if min(x, n) == x */
+    __m128i isDigit = _mm_cmpeq_epi8(_mm_min_epu8(d, _mm_set1_epi8(9)), d);
+    __m128i isLetter = _mm_cmpeq_epi8(_mm_min_epu8(l, _mm_set1_epi8(5)), l);
+    invalid = _mm_or_si128(invalid, _mm_andnot_si128(_mm_or_si128(isDigit, isLetter),
+                                                     _mm_set1_epi8(-1)));
+
+    return _mm_or_si128(_mm_and_si128(isDigit, d),
+                        _mm_andnot_si128(isDigit, _mm_add_epi8(l, _mm_set1_epi8(10))));
+}
+
+/* 16 bytes from 32 hex digits, returns false on other characters */
+static inline bool decode16(const char *in, unsigned char *out)
+{
+    __m128i invalid = _mm_setzero_si128();
+    __m128i a = digitValues(_mm_loadu_si128((const __m128i *) in), invalid);
+    __m128i b = digitValues(_mm_loadu_si128((const __m128i *) (in + 16)), invalid);
+    if(_mm_movemask_epi8(invalid) != 0)
+        return false;
+
+    /* Every 16 bit lane holds the high digit in its low byte */
+    const __m128i low = _mm_set1_epi16(0x00ff);
+    a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, low), 4), _mm_srli_epi16(a, 8));
+    b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, low), 4), _mm_srli_epi16(b, 8));
+    _mm_storeu_si128((__m128i *) out, _mm_packus_epi16(a, b));
+    return true;
+}
+#endif
+
+void Codec::encodeHex(const unsigned char *in, size_t size, char *out)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= size; i += 16)
+        encode16(in + i, out + 2 * i);
+#endif
+    for(; i < size; i++) {
+        out[2 * i] = digits[in[i] >> 4];
+        out[2 * i + 1] = digits[in[i] & 0xf];
+    }
+}
+
+bool Codec::decodeHex(const char *in, size_t size, unsigned char *out)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    for(; i + 16 <= size; i += 16) {
+        if(not decode16(in + 2 * i, out + i))
+            return false;
+    }
+#endif
+    for(; i < size; i++) {
+        int hi = hexValue(in[2 * i]);
+        int lo = hexValue(in[2 * i + 1]);
+        if(hi < 0 or lo < 0)
+            return false;
+        out[i] = (hi << 4) | lo;
+    }
+    return true;
+}
+
+/* Decimal digits of n, returns the number of characters */
+static inline int formatNumber(unsigned n, char *out)
+{
+    char buffer[5];
+    int len = 0;
+    do {
+        buffer[len++] = '0' + n % 10;
+        n /= 10;
+    } while(n > 0);
+
+    for(int i=0; i<len; i++)
+        out[i] = buffer[len - 1 - i];
+    return len;
+}
+
+int Codec::formatEndpoint(const Endpoint &e, char *out)
+{
+    int len = 0;
+    if(e.family == 4) {
+        for(int i=0; i<4; i++) {
+            if(i > 0)
+                out[len++] = '.';
+            len += formatNumber(e.addr[i], out + len);
+        }
+    }
+    else {
+        /* inet_ntop() writes the terminating null, which the ']' replaces */
+        out[len++] = '[';
+        if(not inet_ntop(AF_INET6, e.addr, out + len, INET6_ADDRSTRLEN))
+            return 0;
+        len += strlen(out + len);
+        out[len++] = ']';
+    }
+
+    out[len++] = ':';
+    len += formatNumber(e.portNumber(), out + len);
+    return len;
+}
+
+/* Parse a decimal number up to max, advances p */
+static bool parseNumber(const char *&p, const char *end, unsigned max, unsigned &n)
+{
+    const char *start = p;
+    n = 0;
+    while(p < end and *p >= '0' and *p <= '9' and p - start < 5) {
+        n = n * 10 + (*p - '0');
+        p++;
+    }
+    return p > start and n <= max;
+}
+
+bool Codec::parseEndpoint(const char *in, size_t length, Endpoint &e)
+{
+    const char *p = in;
+    const char *end = in + length;
+    Endpoint result;
+
+    if(p < end and *p == '[') {
+        const char *close = (const char *) memchr(p, ']', end - p);
+        if(not close or close - p - 1 >= INET6_ADDRSTRLEN)
+            return false;
+
+        char address[INET6_ADDRSTRLEN];
+        memcpy(address, p + 1, close - p - 1);
+        address[close - p - 1] = '\0';
+        if(inet_pton(AF_INET6, address, result.addr) != 1)
+            return false;
+
+        result.family = 6;
+        p = close + 1;
+    }
+    else {
+        for(int i=0; i<4; i++) {
+            unsigned octet;
+            if(i > 0 and (p >= end or *p++ != '.'))
+                return false;
+            if(not parseNumber(p, end, 255, octet))
+                return false;
+            result.addr[i] = octet;
+        }
+        result.family = 4;
+    }
+
+    unsigned port;
+    if(p >= end or *p++ != ':' or not parseNumber(p, end, 65535, port) or p != end)
+        return false;
+
+    result.port[0] = port >> 8;
+    result.port[1] = port & 0xff;
+    e = result;
+    return true;
+}
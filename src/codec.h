@@ -0,0 +1,109 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+
+#include <QByteArray>
+#include <QString>
+
+#include "endpoint.h"
+#include "nodeid.h"
+
+
+/**
+ * Text formats of ids and endpoints. Ids are 40 hex digits, endpoints
+ * "a.b.c.d:port" or "[v6]:port". The functions write into buffers of
+ * the caller and don't allocate, the Qt helpers at the end append to
+ * an existing buffer or build one string.
+ *
+ * Hex conversion works on 16 bytes at a time with SSE2 where available.
+ */
+class Codec
+{
+public:
+    static const int idLength = 2 * NodeId::size;
+    static const int maxEndpointLength = 47;    /* "[" 39 "]:" 5 */
+
+    /* Write 2 * size hex digits, lower case */
+    static void encodeHex(const unsigned char *in, size_t size, char *out);
+
+    /* Read 2 * size hex digits of any case. Returns false on other characters. */
+    static bool decodeHex(const char *in, size_t size, unsigned char *out);
+
+    /* Value of a hex digit, -1 for other characters */
+    static int hexValue(char c)
+    {
+        if(c >= '0' and c <= '9')
+            return c - '0';
+        c |= 0x20;
+        if(c >= 'a' and c <= 'f')
+            return c - 'a' + 10;
+        return -1;
+    }
+
+    /* Write idLength characters */
+    static void formatId(const NodeId &id, char *out)
+    {
+        encodeHex(id.data, NodeId::size, out);
+    }
+
+    /* Parse exactly idLength hex digits */
+    static bool parseId(const char *in, size_t length, NodeId &id)
+    {
+        return length == idLength and decodeHex(in, NodeId::size, id.data);
+    }
+
+    /* Write at most maxEndpointLength characters, returns the length */
+    static int formatEndpoint(const Endpoint &e, char *out);
+
+    /* Parse "a.b.c.d:port" or "[v6]:port" */
+    static bool parseEndpoint(const char *in, size_t length, Endpoint &e);
+
+    static bool parseId(const QByteArray &text, NodeId &id)
+    {
+        return parseId(text.constData(), text.size(), id);
+    }
+
+    static void appendId(QByteArray &out, const NodeId &id)
+    {
+        int n = out.size();
+        out.resize(n + idLength);
+        formatId(id, out.data() + n);
+    }
+
+    static void appendEndpoint(QByteArray &out, const Endpoint &e)
+    {
+        char buffer[maxEndpointLength];
+        out.append(buffer, formatEndpoint(e, buffer));
+    }
+
+    static QString idToString(const NodeId &id)
+    {
+        char buffer[idLength];
+        formatId(id, buffer);
+        return QString::fromLatin1(buffer, idLength);
+    }
+
+    static QString endpointToString(const Endpoint &e)
+    {
+        char buffer[maxEndpointLength];
+        return QString::fromLatin1(buffer, formatEndpoint(e, buffer));
+    }
+};
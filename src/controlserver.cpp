@@ -0,0 +1,346 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <QDebug>
+
+#include "controlserver.h"
+#include "codec.h"
+#include "peertable.h"
+
+
+/* Output is coalesced while more than this many bytes wait for the client */
+static const qint64 highWater = 256 * 1024;
+
+/* Clients with more coalesced peers than this are disconnected */
+static const int maxBacklog = 1000000;
+
+/* Clients that send longer lines are disconnected */
+static const int maxLineSize = 1024;
+
+/* Peers per "values" line */
+static const int peersPerLine = 256;
+
+
+ControlServer::ControlServer(DhtEngine *engine, QObject *parent) :
+    QObject(parent),
+    engine(engine),
+    server(new QLocalServer(this)),
+    dropPending(false)
+{
+    connect(server, &QLocalServer::newConnection, this, &ControlServer::newConnection);
+    connect(engine, &DhtEngine::searchesChanged, this, &ControlServer::searchesChanged);
+}
+
+ControlServer::~ControlServer()
+{
+    for(auto it = clients.begin(); it != clients.end(); ++it) {
+        disconnect(it.key(), nullptr, this, nullptr);
+        delete it.value();
+    }
+}
+
+/**
+ * Listen on the socket at path, replacing a stale one.
+ * Returns true on success.
+ */
+bool ControlServer::listen(const QString &path)
+{
+    QLocalServer::removeServer(path);
+    server->setSocketOptions(QLocalServer::UserAccessOption);
+
+    if(not server->listen(path)) {
+        qCritical() << "Can't listen on control socket" << path << server->errorString();
+        return false;
+    }
+    qInfo() << "Control socket at" << server->fullServerName();
+    return true;
+}
+
+void ControlServer::newConnection(void)
+{
+    while(server->hasPendingConnections()) {
+        Client *client = new Client;
+        client->socket = server->nextPendingConnection();
+        client->backlogSize = 0;
+        client->slow = false;
+        clients.insert(client->socket, client);
+
+        connect(client->socket, &QLocalSocket::readyRead, this, &ControlServer::readCommands);
+        connect(client->socket, &QLocalSocket::bytesWritten, this, &ControlServer::writeBacklog);
+        connect(client->socket, &QLocalSocket::disconnected, this, &ControlServer::clientDisconnected);
+    }
+}
+
+void ControlServer::readCommands(void)
+{
+    Client *client = clients.value(qobject_cast<QLocalSocket *>(sender()));
+    if(not client)
+        return;
+
+    while(client->socket->canReadLine()) {
+        QByteArray line = client->socket->readLine().trimmed();
+        if(not line.isEmpty())
+            execute(client, line);
+    }
+
+    if(client->socket->bytesAvailable() > maxLineSize) {
+        qWarning("Control client sent an overlong line");
+        client->socket->abort();
+    }
+}
+
+/**
+ * Run one command and write the reply
+ */
+void ControlServer::execute(Client *client, const QByteArray &line)
+{
+    QLocalSocket *socket = client->socket;
+
+    int space = line.indexOf(' ');
+    QByteArray command = space < 0 ? line : line.left(space);
+    QByteArray arg = space < 0 ? QByteArray() : line.mid(space + 1).trimmed();
+
+    if(command == "ping") {
+        socket->write("pong\n");
+        return;
+    }
+
+    if(command != "search" and command != "refresh" and command != "cancel") {
+        socket->write("error unknown command\n");
+        return;
+    }
+
+    NodeId id;
+    if(not Codec::parseId(arg, id)) {
+        socket->write("error invalid hash\n");
+        return;
+    }
+    QByteArray hash((const char *) id.data, NodeId::size);
+
+    if(command == "cancel") {
+        unsubscribe(client, hash);
+    }
+    else if((command == "refresh" or not engine->acquireSearch(id, this)) and
+            not engine->startSearch(id, this)) {
+        socket->write("error search not accepted\n");
+        return;
+    }
+
+    QByteArray reply = "ok " + command + ' ';
+    Codec::appendId(reply, id);
+    reply.append('\n');
+    socket->write(reply);
+
+    if(command != "cancel")
+        subscribe(client, hash);
+}
+
+/**
+ * Add a subscriber to a search and send the peers found so far, and
+ * "done" if the search already completed
+ */
+void ControlServer::subscribe(Client *client, const QByteArray &hash)
+{
+    if(client->hashes.contains(hash))
+        return;
+
+    client->hashes.append(hash);
+    subscribers[hash].append(client);
+
+    SearchInfo *info = engine->findSearchInfo(NodeId::fromBytes(hash.constData()));
+    if(info and info->results.size() > 0) {
+        const PeerTable &peers = PeerTable::global();
+        QVector<Endpoint> found;
+        found.reserve(info->results.size());
+        info->results.forEach([&found, &peers](uint32_t id) {
+            found.append(peers.endpoint(id));
+        });
+        sendValues(client, hash, found);
+    }
+
+    /* A completion that wasn't reported yet follows with searchesChanged() */
+    if(info and info->pendingFamilies == 0 and not info->completed)
+        sendDone(client, hash, info->results.size());
+}
+
+/**
+ * Remove a subscriber. A search without subscribers is released.
+ */
+void ControlServer::unsubscribe(Client *client, const QByteArray &hash)
+{
+    if(not client->hashes.removeOne(hash))
+        return;
+
+    auto pending = client->backlog.find(hash);
+    if(pending != client->backlog.end()) {
+        client->backlogSize -= pending->peers.size();
+        client->backlog.erase(pending);
+    }
+
+    QList<Client *> &list = subscribers[hash];
+    list.removeOne(client);
+    if(list.isEmpty()) {
+        subscribers.remove(hash);
+        engine->releaseSearch(NodeId::fromBytes(hash.constData()), this);
+    }
+}
+
+void ControlServer::clientDisconnected(void)
+{
+    auto socket = qobject_cast<QLocalSocket *>(sender());
+    Client *client = clients.take(socket);
+    if(not client)
+        return;
+
+    for(auto &hash : QList<QByteArray>(client->hashes))
+        unsubscribe(client, hash);
+
+    delete client;
+    socket->deleteLater();
+}
+
+/**
+ * Forward new results and completions to the subscribers
+ */
+void ControlServer::searchesChanged(const QVector<SearchChange> &changes)
+{
+    const PeerTable &table = PeerTable::global();
+
+    for(auto &change : changes) {
+        QByteArray hash((const char *) change.id.data, 20);
+        auto it = subscribers.constFind(hash);
+        if(it == subscribers.constEnd())
+            continue;
+
+        if(not change.peers.empty()) {
+            QVector<Endpoint> peers;
+            peers.reserve(change.peers.size());
+            for(uint32_t peer : change.peers)
+                peers.append(table.endpoint(peer));
+
+            for(Client *client : *it)
+                sendValues(client, hash, peers);
+        }
+
+        if(change.completed) {
+            SearchInfo *info = engine->findSearchInfo(change.id);
+            int count = info ? info->results.size() : 0;
+            for(Client *client : *it)
+                sendDone(client, hash, count);
+        }
+    }
+}
+
+bool ControlServer::congested(Client *client) const
+{
+    return client->socket->bytesToWrite() > highWater;
+}
+
+/**
+ * Write values, or add them to the backlog while the client is behind
+ */
+void ControlServer::sendValues(Client *client, const QByteArray &hash, const QVector<Endpoint> &peers)
+{
+    if(client->slow)
+        return;
+
+    if(congested(client) or client->backlog.contains(hash)) {
+        Pending &pending = client->backlog[hash];
+        pending.peers += peers;
+        client->backlogSize += peers.size();
+
+        if(client->backlogSize > maxBacklog) {
+            client->slow = true;
+            if(not dropPending) {
+                dropPending = true;
+                QMetaObject::invokeMethod(this, "dropSlowClients", Qt::QueuedConnection);
+            }
+        }
+        return;
+    }
+
+    auto id = NodeId::fromBytes(hash.constData());
+    for(int i=0; i<peers.size(); i+=peersPerLine) {
+        QByteArray line = "values ";
+        Codec::appendId(line, id);
+        for(int j=i; j<peers.size() and j<i+peersPerLine; j++) {
+            line.append(' ');
+            Codec::appendEndpoint(line, peers[j]);
+        }
+        line.append('\n');
+        client->socket->write(line);
+    }
+}
+
+void ControlServer::sendDone(Client *client, const QByteArray &hash, quint64 total)
+{
+    if(client->slow)
+        return;
+
+    auto pending = client->backlog.find(hash);
+    if(pending != client->backlog.end()) {
+        pending->done = true;
+        pending->total = total;
+        return;
+    }
+
+    QByteArray line = "done ";
+    Codec::appendId(line, NodeId::fromBytes(hash.constData()));
+    line.append(' ');
+    line.append(QByteArray::number(total));
+    line.append('\n');
+    client->socket->write(line);
+}
+
+/**
+ * Work off the backlog as the socket drains
+ */
+void ControlServer::writeBacklog(void)
+{
+    Client *client = clients.value(qobject_cast<QLocalSocket *>(sender()));
+    if(not client or client->slow)
+        return;
+
+    while(not client->backlog.isEmpty() and not congested(client)) {
+        auto it = client->backlog.begin();
+        QByteArray hash = it.key();
+        Pending pending = it.value();
+        client->backlog.erase(it);
+        client->backlogSize -= pending.peers.size();
+
+        sendValues(client, hash, pending.peers);
+        if(pending.done)
+            sendDone(client, hash, pending.total);
+    }
+}
+
+void ControlServer::dropSlowClients(void)
+{
+    dropPending = false;
+
+    QList<QLocalSocket *> slow;
+    for(auto it = clients.begin(); it != clients.end(); ++it) {
+        if(it.value()->slow)
+            slow.append(it.key());
+    }
+
+    for(auto socket : slow) {
+        qWarning("Disconnecting a control client that doesn't read its results");
+        socket->abort();
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QObject>
+#include <QLocalServer>
+#include <QLocalSocket>
+#include <QHash>
+#include <QList>
+#include <QVector>
+
+#include "dhtengine.h"
+
+
+/**
+ * Control API on a Unix domain socket, so other programs can use a
+ * running node for lookups. The protocol is line based:
+ *
+ *   search <hash>      Subscribe to a search, start it if it isn't running
+ *   refresh <hash>     Restart a search and subscribe to it
+ *   cancel <hash>      Unsubscribe, the search is released with its last subscriber
+ *   ping               Answered with "pong"
+ *
+ * Every command is answered with "ok <command> <hash>" or "error <message>".
+ * Subscribers receive "values <hash> <peer> ..." for new peers as they
+ * arrive, starting with the peers found so far, and "done <hash> <peers>"
+ * when a search completes. Hashes are 40 hex digits.
+ *
+ * The server is one owner of the searches its clients subscribed to, a
+ * search that a batch, monitor or crawler also started keeps running
+ * for them when the last subscriber cancels, and the other way round.
+ *
+ * A client that doesn't read fast enough gets its values coalesced per
+ * search until its socket drains. Clients whose backlog still grows past
+ * a limit are disconnected.
+ */
+class ControlServer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ControlServer(DhtEngine *engine, QObject *parent = 0);
+    ~ControlServer();
+
+    bool listen(const QString &path);
+
+private slots:
+    void newConnection(void);
+    void readCommands(void);
+    void writeBacklog(void);
+    void clientDisconnected(void);
+    void searchesChanged(const QVector<SearchChange> &changes);
+    void dropSlowClients(void);
+
+private:
+    struct Pending
+    {
+        Pending() :
+            done(false),
+            total(0)
+        { }
+
+        QVector<Endpoint> peers;    /* Values not written yet */
+        bool done;                  /* The search completed after these values */
+        quint64 total;              /* Number of peers when it completed */
+    };
+
+    struct Client
+    {
+        QLocalSocket *socket;
+        QList<QByteArray> hashes;   /* Subscribed searches */
+        QHash<QByteArray, Pending> backlog;     /* Coalesced output by search */
+        int backlogSize;            /* Peers in the backlog */
+        bool slow;                  /* Disconnected at the next chance */
+    };
+
+    void execute(Client *client, const QByteArray &line);
+    void subscribe(Client *client, const QByteArray &hash);
+    void unsubscribe(Client *client, const QByteArray &hash);
+    void sendValues(Client *client, const QByteArray &hash, const QVector<Endpoint> &peers);
+    void sendDone(Client *client, const QByteArray &hash, quint64 total);
+    bool congested(Client *client) const;
+
+    DhtEngine *engine;
+    QLocalServer *server;
+    QHash<QLocalSocket *, Client *> clients;
+    QHash<QByteArray, QList<Client *>> subscribers;     /* Clients by hash of the search */
+    bool dropPending;
+};
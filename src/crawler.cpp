@@ -0,0 +1,229 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <QDebug>
+#include "crawler.h"
+#include "dhtinternal.h"
+
+
+/* Lookups are started once this many good nodes are known */
+static const int minGoodNodes = 16;
+
+/* Start anyway after this many milliseconds */
+static const int maxWarmup = 60000;
+
+/*
+ * No lookups are started while more datagrams than this wait in the send
+ * queue. The send rate is the packet budget, the crawler only keeps the
+ * queue from overflowing.
+ */
+static const int maxPendingDatagrams = 512;
+
+/* Step of the target prefixes, consecutive targets are far apart */
+static const uint32_t targetStep = 0x9e3779b9;
+
+/* The crawler that receives the addresses from dht.c */
+static Crawler *active = nullptr;
+
+
+Crawler::Crawler(DhtEngine *engine, int concurrency, QObject *parent) :
+    QObject(parent),
+    engine(engine),
+    concurrency(concurrency),
+    reportInterval(10),
+    refillScheduled(false),
+    targetPrefix(rand()),
+    lookups(0),
+    lastNodes(0),
+    lastLookups(0),
+    lastReport(0),
+    reportTimer(nullptr),
+    warmupTimer(nullptr)
+{
+    connect(engine, &DhtEngine::searchesChanged, this, &Crawler::searchesChanged);
+
+    active = this;
+    dht_internal_set_seen_function(&Crawler::nodeSeen);
+}
+
+Crawler::~Crawler()
+{
+    dht_internal_set_seen_function(nullptr);
+    active = nullptr;
+
+    qInfo() << "Crawled" << nodes.size4() + nodes.size6() << "nodes with"
+            << lookups << "lookups";
+    output.flush();
+}
+
+/**
+ * Open the report output. Returns true on success.
+ */
+bool Crawler::open(int reportInterval)
+{
+    this->reportInterval = reportInterval;
+    return output.open(stdout, QIODevice::WriteOnly);
+}
+
+/**
+ * Start the lookups as soon as the routing table is populated.
+ * Nodes are counted from the start.
+ */
+void Crawler::start(void)
+{
+    runtime.start();
+    warmup.start();
+    warmupTimer = new QTimer(this);
+    connect(warmupTimer, &QTimer::timeout, this, &Crawler::waitForNodes);
+    warmupTimer->start(1000);
+
+    reportTimer = new QTimer(this);
+    connect(reportTimer, &QTimer::timeout, this, &Crawler::report);
+    reportTimer->start(reportInterval * 1000);
+}
+
+/**
+ * Check if there are enough good nodes to start crawling
+ */
+void Crawler::waitForNodes(void)
+{
+    int good4, good6;
+    engine->getNodeCounts(good4, good6);
+
+    if(good4 + good6 < minGoodNodes and warmup.elapsed() < maxWarmup)
+        return;
+
+    qInfo() << "Starting crawl with" << good4 + good6 << "good nodes";
+    warmupTimer->stop();
+    refill();
+}
+
+/**
+ * Called by dht.c for every address that passed the filter
+ */
+void Crawler::nodeSeen(const sockaddr *sa, int salen)
+{
+    if(active)
+        active->nodes.insert(sa, salen);
+}
+
+/**
+ * Next lookup target. The first 32 bits follow a Weyl sequence, so the
+ * lookups in flight are spread evenly over the keyspace, the rest is random.
+ */
+NodeId Crawler::nextTarget(void)
+{
+    targetPrefix += targetStep;
+
+    NodeId id;
+    id.data[0] = targetPrefix >> 24;
+    id.data[1] = targetPrefix >> 16;
+    id.data[2] = targetPrefix >> 8;
+    id.data[3] = targetPrefix;
+    for(int i=4; i<NodeId::size; i++)
+        id.data[i] = rand() % 256;
+    return id;
+}
+
+/**
+ * Collect the completed lookups and replace them
+ */
+void Crawler::searchesChanged(const QVector<SearchChange> &changes)
+{
+    for(auto &change : changes) {
+        if(change.completed and inFlight.contains(change.id))
+            completed.append(change.id);
+    }
+
+    if(not completed.isEmpty())
+        refill();
+}
+
+/**
+ * Release completed lookups and start new ones until the window
+ * is full or the send queue is busy.
+ */
+void Crawler::refill(void)
+{
+    refillScheduled = false;
+
+    for(auto &id : completed) {
+        if(inFlight.remove(id)) {
+            engine->releaseSearch(id, this);
+            lookups++;
+        }
+    }
+    completed.clear();
+
+    int delay = 0;
+    while(inFlight.size() < concurrency) {
+        if(engine->pendingDatagrams() > maxPendingDatagrams) {
+            delay = 100;
+            break;
+        }
+
+        NodeId id = nextTarget();
+        if(not engine->startSearch(id, this)) {
+            /* The DHT doesn't accept more searches right now */
+            delay = 1000;
+            break;
+        }
+        inFlight.insert(id);
+    }
+
+    if(delay > 0 and not refillScheduled) {
+        refillScheduled = true;
+        QTimer::singleShot(delay, this, &Crawler::refill);
+    }
+}
+
+/**
+ * Write a line with the elapsed seconds, the number of nodes, the nodes
+ * per family, the new nodes and lookups per second since the last report,
+ * and the memory of the node set.
+ */
+void Crawler::report(void)
+{
+    qint64 now = runtime.elapsed();
+    double seconds = (now - lastReport) / 1000.0;
+    quint64 total = nodes.size4() + nodes.size6();
+
+    QByteArray line = QByteArray::number(now / 1000.0, 'f', 1);
+    line.append(' ');
+    line.append(QByteArray::number(total));
+    line.append(' ');
+    line.append(QByteArray::number((quint64) nodes.size4()));
+    line.append(' ');
+    line.append(QByteArray::number((quint64) nodes.size6()));
+    line.append(' ');
+    line.append(QByteArray::number((total - lastNodes) / seconds, 'f', 1));
+    line.append(' ');
+    line.append(QByteArray::number((lookups - lastLookups) / seconds, 'f', 1));
+    line.append(' ');
+    line.append(QByteArray::number((quint64) nodes.memoryUsage()));
+    line.append('\n');
+    output.write(line);
+    output.flush();
+
+    lastNodes = total;
+    lastLookups = lookups;
+    lastReport = now;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include <QSet>
+
+#include "dhtengine.h"
+#include "nodeset.h"
+
+
+/**
+ * Discovers as many nodes as possible by searching for random targets
+ * all over the keyspace. Every address dht.c sees is recorded in a
+ * NodeSet, which is independent of the size of the routing table, and
+ * the discovery rate is written to stdout at a fixed interval.
+ */
+class Crawler : public QObject
+{
+    Q_OBJECT
+
+public:
+    Crawler(DhtEngine *engine, int concurrency, QObject *parent = 0);
+    ~Crawler();
+
+    bool open(int reportInterval);      /* Seconds between two reports */
+    void start(void);
+
+private slots:
+    void searchesChanged(const QVector<SearchChange> &changes);
+    void refill(void);
+    void waitForNodes(void);
+    void report(void);
+
+private:
+    static void nodeSeen(const sockaddr *sa, int salen);
+    NodeId nextTarget(void);
+
+    DhtEngine *engine;
+    int concurrency;            /* Maximum number of lookups in flight */
+    int reportInterval;
+    QFile output;
+
+    NodeSet nodes;              /* Every node seen since the start */
+    QSet<NodeId> inFlight;      /* Lookups started by the crawler */
+    QList<NodeId> completed;    /* Lookups to release at the next refill */
+    bool refillScheduled;       /* A timer calls refill() */
+    uint32_t targetPrefix;      /* First 32 bits of the last target */
+
+    quint64 lookups;            /* Number of completed lookups */
+    quint64 lastNodes;          /* Counters at the last report */
+    quint64 lastLookups;
+    qint64 lastReport;
+
+    QTimer *reportTimer;
+    QTimer *warmupTimer;        /* Polls the routing table before the start */
+    QElapsedTimer warmup;
+    QElapsedTimer runtime;
+};
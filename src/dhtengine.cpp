@@ -0,0 +1,1013 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <algorithm>
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QByteArray>
+#include "dhtengine.h"
+#include "codec.h"
+#include "routingsnapshot.h"
+#include "metrics.h"
+#include "logger.h"
+#include "dhtinternal.h"
+#include "admission.h"
+#include "dht/dht.h"
+
+
+/* Numbers of good nodes for which the time since the start is logged */
+static const int warmupSteps[] = {8, 32, 128, 512};
+
+/* Queue for the datagrams dht.c sends, see queuedSend() */
+static SendQueue *outbound = nullptr;
+
+
+DhtEngine::DhtEngine(QObject *parent) :
+    QObject(parent),
+    s4(-1),
+    s6(-1),
+    reactor(nullptr),
+    reactorNotifier(nullptr),
+    periodicTimer(-1),
+    sendQueue(nullptr),
+    nodeTimer(nullptr),
+    snapshotTimer(nullptr),
+    warmupTimer(nullptr),
+    metricsTimer(nullptr),
+    warmupStep(0),
+    recvBatch(new RecvBatch),
+    wakeups(0),
+    datagrams(0),
+    drops4(0),
+    drops6(0),
+    events(nullptr),
+    exporter(nullptr),
+    notifyPending(false),
+    lastGood4(0),
+    lastGood6(0),
+    lastDrops(0),
+    lastAdmission(),
+    lastReactor(),
+    lastSend(),
+    changesPending(false),
+    portOverride(0),
+    sendRateOverride(0),
+    idOverride(false),
+    settings(nullptr),
+    myID(nullptr)
+{
+
+}
+
+/**
+ * Use port instead of the configured port. Must be called before init().
+ */
+void DhtEngine::setPort(int port)
+{
+    portOverride = port;
+}
+
+/**
+ * Send at most rate datagrams per second instead of the configured
+ * rate. Must be called before init().
+ */
+void DhtEngine::setSendRate(unsigned rate)
+{
+    sendRateOverride = rate;
+}
+
+/**
+ * Read the configuration from path instead of the default location.
+ * Must be called before init().
+ */
+void DhtEngine::setConfigFile(const QString &path)
+{
+    configFile = path;
+}
+
+/**
+ * Use id as node ID instead of the configured one. The ID isn't
+ * saved to the configuration. Must be called before init().
+ */
+void DhtEngine::setNodeId(const NodeId &id)
+{
+    overrideID = id;
+    idOverride = true;
+}
+
+DhtEngine::~DhtEngine()
+{
+    if(settings) {
+        auto peers = getPeers();
+        settings->setValue("nodes", peers);
+        settings->sync();
+        saveSnapshot();
+    }
+
+    dht_uninit();
+    searches.forEach([this](SearchInfo *info) {
+        searchPool.destroy(info);
+    });
+
+    if(s4 >= 0)
+        ::close(s4);
+
+    if(s6 >= 0)
+        ::close(s6);
+
+    dht_internal_set_send_function(nullptr);
+    outbound = nullptr;
+
+    delete reactorNotifier;
+    delete sendQueue;
+    delete reactor;
+    delete nodeTimer;
+    delete snapshotTimer;
+    delete warmupTimer;
+    delete metricsTimer;
+    delete recvBatch;
+
+    delete settings;
+    delete[] myID;
+}
+
+/**
+ * Initialize the DHT. Returns true on success.
+ */
+bool DhtEngine::init()
+{
+    /* Get the configuration */
+    auto cfgfile = configFile;
+    if(cfgfile.isEmpty())
+        cfgfile = QString("%1/.config/dht-explorer/default.conf").arg(QDir::homePath());
+    settings = new QSettings(cfgfile, QSettings::IniFormat, this);
+
+    auto port = settings->value("port", "6881").toInt();
+    auto useIPv4 = settings->value("IPv4", "1").toInt();
+    auto useIPv6 = settings->value("IPv6", "1").toInt();
+    auto id = settings->value("ID", "").toString();
+    auto btNodes = settings->value("nodes", QStringList() << "82.221.103.244:6881").toStringList();
+    auto blocklist = settings->value("blocklist", "").toString();
+    auto rateLimit = settings->value("rateLimit", "50").toUInt();
+    auto rateBurst = settings->value("rateBurst", "200").toUInt();
+    auto sendRate = settings->value("sendRate", "2000").toUInt();
+    auto sendBurst = settings->value("sendBurst", "256").toUInt();
+    auto sendDepth = settings->value("sendQueue", "4096").toUInt();
+
+    if(portOverride > 0)
+        port = portOverride;
+    if(sendRateOverride > 0)
+        sendRate = sendRateOverride;
+
+    /* Create a new ID if it doesn't exist */
+    myID = new unsigned char[20];
+    NodeId parsed;
+    if(idOverride) {
+        memcpy(&myID[0], overrideID.data, 20);
+        id = Codec::idToString(overrideID);
+    }
+    else if(not Codec::parseId(id.toLatin1(), parsed)) {
+        /* Generate new ID */
+        for(int i=0; i<20; i++)
+            myID[i] = rand() % 256;
+        settings->setValue("ID", Codec::idToString(NodeId::fromBytes(myID)));
+    }
+    else {
+        memcpy(&myID[0], parsed.data, 20);
+    }
+    qDebug() << "Using ID" << id;
+    settings->sync();
+
+    /* Initialize the sockets and the DHT */
+    int rc;
+
+    sockaddr_in  sin4;
+    sockaddr_in6 sin6;
+
+    memset(&sin4, 0, sizeof(sin4));
+    sin4.sin_family = AF_INET;
+
+    memset(&sin6, 0, sizeof(sin6));
+    sin6.sin6_family = AF_INET6;
+
+    if(useIPv4) {
+        s4 = socket(AF_INET, SOCK_DGRAM, 0);
+        if(s4 < 0) {
+            qCritical("Creation of IPv4 socket failed");
+            return false;
+        }
+
+        /* Setup the IPv4 socket */
+        sin4.sin_port = htons(port);
+        rc = bind(s4, (sockaddr*) &sin4, sizeof(sin4));
+        if(rc < 0) {
+            qCritical("Binding of IPv4 socket failed");
+            return false;
+        }
+
+        if(not RecvBatch::enableDropCounter(s4)) {
+            qWarning("Can't enable drop counter on IPv4 socket");
+        }
+    }
+
+    /* IPv6 is optional, the DHT continues with IPv4 only if the
+     * socket can't be set up. */
+    if(useIPv6) {
+        s6 = socket(AF_INET6, SOCK_DGRAM, 0);
+        if(s6 < 0) {
+            qWarning("Creation of IPv6 socket failed");
+        }
+    }
+
+    if(s6 >= 0) {
+        /* Setup the IPv6 socket */
+        int val = 1;
+        rc = setsockopt(s6, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &val, sizeof(val));
+        if(rc == 0) {
+            sin6.sin6_port = htons(port);
+            rc = bind(s6, (sockaddr*)&sin6, sizeof(sin6));
+        }
+
+        if(rc < 0) {
+            qWarning("Setup of IPv6 socket failed");
+            ::close(s6);
+            s6 = -1;
+        }
+        else if(not RecvBatch::enableDropCounter(s6)) {
+            qWarning("Can't enable drop counter on IPv6 socket");
+        }
+    }
+
+    if(s4 < 0 and s6 < 0) {
+        qCritical("No socket available");
+        return false;
+    }
+
+    /* The reactor watches the sockets and calls dht_periodic */
+    reactor = new Reactor;
+    if(not reactor->init()) {
+        qCritical("Creation of the reactor failed");
+        return false;
+    }
+
+    auto handler = [this](int s) { socketActivated(s); };
+    if((s4 >= 0 and not reactor->addSocket(s4, handler)) or
+       (s6 >= 0 and not reactor->addSocket(s6, handler))) {
+        qCritical("Can't watch the sockets");
+        return false;
+    }
+    periodicTimer = reactor->addTimer([this]() { timerActivated(); });
+    if(periodicTimer < 0) {
+        qCritical("Creation of the timer failed");
+        return false;
+    }
+    reactor->scheduleIn(periodicTimer, 0);
+
+    /* Outgoing datagrams are queued and paced, from the first ping on */
+    sendQueue = new SendQueue(reactor);
+    if(not sendQueue->init()) {
+        qCritical("Creation of the send queue failed");
+        return false;
+    }
+    sendQueue->setLimits(sendRate, sendBurst, sendDepth);
+    outbound = sendQueue;
+    dht_internal_set_send_function(&DhtEngine::queuedSend);
+
+    /* Filter for incoming packets, see admission.h */
+    admission_set_rate(rateLimit, rateBurst);
+    if(not blocklist.isEmpty()) {
+        rc = admission_load_blocklist(QFile::encodeName(blocklist).constData());
+        if(rc < 0) {
+            qWarning() << "Can't read blocklist" << blocklist;
+        }
+        else {
+            qDebug() << "Blocked" << rc << "prefixes from" << blocklist;
+        }
+    }
+
+    /* Setup the DHT. This sets the sockets to non-blocking. */
+    startTime.start();
+    rc = dht_init(s4, s6, myID, (unsigned char *)"AFG\0");
+    if(rc < 0) {
+        qCritical("dht_init() failed");
+        return false;
+    }
+
+    /* Restore the routing table of the last run */
+    /* Instances on other ports keep their own routing table */
+    snapshotPath = QFileInfo(settings->fileName()).absolutePath() +
+            (portOverride > 0 ? QString("/nodes-%1.dat").arg(port) : QString("/nodes.dat"));
+    rc = RoutingSnapshot::load(snapshotPath, s4 >= 0, s6 >= 0);
+    if(rc >= 0) {
+        qDebug() << "Restored" << rc << "nodes from" << snapshotPath;
+    }
+
+    /* Bootstrap the DHT */
+    for(auto &s : btNodes) {
+        QByteArray text = s.toLatin1();
+        Endpoint node;
+        if(not Codec::parseEndpoint(text.constData(), text.size(), node))
+            continue;
+        if((node.family == 4 and s4 < 0) or (node.family == 6 and s6 < 0))
+            continue;
+
+        sockaddr_storage ss;
+        socklen_t salen = node.toSockaddr(ss);
+        rc = dht_ping_node((sockaddr*) &ss, salen);
+        if(rc > 0) {
+            qDebug() << "Bootstrapped from" << s;
+        }
+        else {
+            qDebug() << "Bootstrapping from" << s << "failed";
+        }
+    }
+
+    /* At this point, the DHT should be initialized. We can now process
+     * the remaining events through the event loop, which only watches
+     * the reactor's descriptor.
+     */
+    sendQueue->flush();
+    reactorNotifier = new QSocketNotifier(reactor->fd(), QSocketNotifier::Read, this);
+    connect(reactorNotifier, &QSocketNotifier::activated, this, &DhtEngine::reactorActivated);
+
+    snapshotTimer = new QTimer(this);
+    connect(snapshotTimer, &QTimer::timeout, this, &DhtEngine::saveSnapshot);
+    snapshotTimer->start(5 * 60 * 1000);
+
+    warmupTimer = new QTimer(this);
+    connect(warmupTimer, &QTimer::timeout, this, &DhtEngine::checkWarmup);
+    warmupTimer->start(250);
+
+    metricsTimer = new QTimer(this);
+    connect(metricsTimer, &QTimer::timeout, this, &DhtEngine::updateMetrics);
+    metricsTimer->start(1000);
+
+    /* Routing table changes are published at most four times a second */
+    if(events) {
+        nodeTimer = new QTimer(this);
+        connect(nodeTimer, &QTimer::timeout, this, &DhtEngine::updateNodes);
+        nodeTimer->start(250);
+    }
+
+    return true;
+}
+
+/**
+ * The reactor's descriptor is readable, a socket or the timer is ready.
+ */
+void DhtEngine::reactorActivated(void)
+{
+    reactor->dispatch(0);
+    sendQueue->flush();
+}
+
+/**
+ * Activity on a socket. The socket is drained completely and every
+ * datagram is passed to dht_periodic before the next call is scheduled.
+ */
+void DhtEngine::socketActivated(int s)
+{
+    /* Receive and process datagrams */
+    int rc = 0;
+    int received = 0;
+    time_t tosleep = 0;
+
+    quint32 &drops = (s == s4) ? drops4 : drops6;
+    quint32 lastDrops = drops;
+    quint64 bytes = 0;
+    int processed = 0;
+
+    for(;;) {
+        int n = recvBatch->receive(s);
+        Metrics::add(Metrics::ReceiveCalls);
+        if(n <= 0)
+            break;
+
+        for(int i=0; i<n; i++) {
+            uint32_t count;
+            if(recvBatch->dropped(i, count))
+                drops = count;
+
+            bytes += recvBatch->length(i);
+            if(admission_check(recvBatch->source(i), recvBatch->sourceLength(i)))
+                continue;
+
+            auto start = Metrics::now();
+            rc = dht_periodic(recvBatch->data(i), recvBatch->length(i),
+                              recvBatch->source(i), recvBatch->sourceLength(i),
+                              &tosleep, this->dhtCallback, this);
+            Metrics::observePeriodic(Metrics::now() - start);
+            processed++;
+        }
+        received += n;
+
+        /* A short batch means the receive queue is empty */
+        if(n < RecvBatch::size)
+            break;
+    }
+
+    /* dht_periodic also runs its timers if every datagram was dropped */
+    if(processed == 0) {
+        auto start = Metrics::now();
+        rc = dht_periodic(nullptr, 0, nullptr, 0, &tosleep, this->dhtCallback, this);
+        Metrics::observePeriodic(Metrics::now() - start);
+    }
+
+    wakeups++;
+    datagrams += received;
+    Metrics::add(Metrics::SocketWakeups);
+    Metrics::add(s == s4 ? Metrics::DatagramsIn4 : Metrics::DatagramsIn6, received);
+    Metrics::add(s == s4 ? Metrics::BytesIn4 : Metrics::BytesIn6, bytes);
+    LOG_RATE(LOG_LEVEL_TRACE, 10, "%1 socket activated, %2 datagrams, average %3 per wakeup",
+             s == s4 ? "IPv4" : "IPv6", received, double(datagrams) / wakeups);
+
+    if(drops != lastDrops) {
+        LOG_RATE(LOG_LEVEL_WARNING, 1, "Receive queue overflow, %1 datagrams dropped",
+                 drops - lastDrops);
+    }
+
+    scheduleNext(rc, tosleep);
+}
+
+/**
+ * Process a datagram that didn't arrive on the sockets, e.g. from a
+ * simulated network. from is the source address.
+ */
+void DhtEngine::deliver(const char *data, int length, const sockaddr *from, socklen_t fromlen)
+{
+    if(length >= RecvBatch::bufferSize or admission_check(from, fromlen))
+        return;
+
+    /* dht_periodic expects a terminating null byte */
+    char buffer[RecvBatch::bufferSize];
+    memcpy(buffer, data, length);
+    buffer[length] = '\0';
+
+    time_t tosleep = 0;
+    auto start = Metrics::now();
+    int rc = dht_periodic(buffer, length, from, fromlen, &tosleep, this->dhtCallback, this);
+    Metrics::observePeriodic(Metrics::now() - start);
+
+    scheduleNext(rc, tosleep);
+    sendQueue->flush();
+}
+
+/**
+ * Timeout triggered.
+ */
+void DhtEngine::timerActivated(void)
+{
+    LOG_RATE(LOG_LEVEL_TRACE, 10, "Timer activated");
+
+    int rc;
+    time_t tosleep = 0;
+
+    auto start = Metrics::now();
+    rc = dht_periodic(nullptr, 0, nullptr, 0, &tosleep, this->dhtCallback, this);
+    Metrics::observePeriodic(Metrics::now() - start);
+    Metrics::add(Metrics::TimerWakeups);
+
+    scheduleNext(rc, tosleep);
+}
+
+/**
+ * Schedule the next call of dht_periodic after it returned rc and
+ * tosleep. dht.c counts whole seconds of the time it saw during the
+ * call, so its deadline is the start of the second tosleep seconds
+ * later, not tosleep seconds after the call.
+ */
+void DhtEngine::scheduleNext(int rc, time_t tosleep)
+{
+    if(rc < 0) {
+        reactor->scheduleIn(periodicTimer, 1000);
+        return;
+    }
+
+    timeval tv;
+    dht_internal_get_call_time(&tv);
+    reactor->scheduleIn(periodicTimer, qint64(tosleep) * 1000 - tv.tv_usec / 1000);
+}
+
+/**
+ * Called by dht_periodic.
+ * engine is a pointer to the DhtEngine that started the search.
+ */
+void DhtEngine::dhtCallback(void *engine, int event,
+                            const unsigned char *info_hash,
+                            const void *data, size_t data_len)
+{
+    auto self = static_cast<DhtEngine *>(engine);
+
+    switch(event) {
+    case DHT_EVENT_VALUES:          Metrics::add(Metrics::EventValues); break;
+    case DHT_EVENT_VALUES6:         Metrics::add(Metrics::EventValues6); break;
+    case DHT_EVENT_SEARCH_DONE:     Metrics::add(Metrics::EventSearchDone); break;
+    case DHT_EVENT_SEARCH_DONE6:    Metrics::add(Metrics::EventSearchDone6); break;
+    }
+
+    /* Find the SearchInfo structure for the callback */
+    auto id = NodeId::fromBytes(info_hash);
+    SearchInfo *info = self->findSearchInfo(id);
+
+    if(info) {
+        if(event == DHT_EVENT_SEARCH_DONE or event == DHT_EVENT_SEARCH_DONE6) {
+            /* Wait for the searches on the other address family */
+            if(info->pendingFamilies > 0 and --info->pendingFamilies == 0)
+                self->searchDone(info);
+        }
+        else if(event == DHT_EVENT_VALUES or event == DHT_EVENT_VALUES6) {
+            /* Compact peer info is 6 bytes for IPv4 and 18 bytes for IPv6 */
+            bool v6 = event == DHT_EVENT_VALUES6;
+            size_t step = v6 ? 18 : 6;
+            LOG_RATE(LOG_LEVEL_TRACE, 10, "Received %1 %2 values for %3",
+                     data_len / step, v6 ? "IPv6" : "IPv4", id);
+
+            EngineEvent ev(EngineEvent::SearchValues);
+
+            auto values = (const unsigned char *) data;
+            for(size_t i=0; i+step<=data_len; i+=step) {
+                auto peer = v6 ? Endpoint::fromCompact6(&values[i])
+                               : Endpoint::fromCompact4(&values[i]);
+                uint32_t peerId = PeerTable::global().intern(peer);
+                if(info->results.insert(peerId)) {
+                    info->fresh.push_back(peerId);
+                    ev.peers.append(peer);
+                }
+            }
+            info->results.merge();
+
+            if(self->exporter)
+                self->exporter->record(id, ev.peers);
+
+            if(not ev.peers.isEmpty()) {
+                self->markChanged(info);
+                if(self->events) {
+                    ev.hash = QByteArray((const char *) id.data, NodeId::size);
+                    self->publish(std::move(ev));
+                }
+            }
+        }
+    }
+    else {
+        LOG_RATE(LOG_LEVEL_DEBUG, 10, "Callback executed for unknown hash %1", id);
+    }
+}
+
+/**
+ * All address families of a search completed
+ */
+void DhtEngine::searchDone(SearchInfo *info)
+{
+    LOG_DEBUG("Search for %1 completed, %2 peers in %3 bytes",
+              info->id, info->results.size(), info->results.memoryUsage());
+    info->completed = true;
+    markChanged(info);
+
+    if(events) {
+        EngineEvent ev(EngineEvent::SearchDone);
+        ev.hash = QByteArray((const char *) info->id.data, NodeId::size);
+        publish(std::move(ev));
+    }
+}
+
+/**
+ * Start a new search or restart an existing one. The engine owns
+ * the search on behalf of the user interface.
+ */
+void DhtEngine::search(const QByteArray &hash)
+{
+    if(hash.size() != NodeId::size) {
+        qWarning() << "Invalid hash" << hash.toHex();
+        return;
+    }
+
+    startSearch(NodeId::fromBytes(hash.constData()), this);
+}
+
+/**
+ * Remove a search of the user interface. Results arriving later are
+ * ignored, unless another owner keeps the search.
+ */
+void DhtEngine::removeSearch(const QByteArray &hash)
+{
+    if(hash.size() != NodeId::size)
+        return;
+
+    releaseSearch(NodeId::fromBytes(hash.constData()), this);
+}
+
+/**
+ * Start a new search or restart an existing one, and add owner to its
+ * owners. The search and the returned pointer stay valid until every
+ * owner released it with releaseSearch(). Must not be called from
+ * within dht_periodic.
+ */
+SearchInfo *DhtEngine::startSearch(const NodeId &id, QObject *owner)
+{
+    SearchInfo *info = findSearchInfo(id);
+    bool exists = info != nullptr;
+
+    if(exists) {
+        LOG_DEBUG("Restart search for %1", id);
+    }
+    else {
+        info = searchPool.create(id);
+        searches.insert(id, info);
+        Metrics::set(Metrics::ActiveSearches, searches.size());
+        LOG_DEBUG("Start a search for %1", id);
+    }
+
+    /* Search on every available address family. The search is done
+     * once all of them have completed. dht_search() may report a family
+     * as done before it returns, e.g. if its routing table is empty, so
+     * the families are counted before they are started. */
+    int families[2];
+    int numFamilies = 0;
+    if(s4 >= 0)
+        families[numFamilies++] = AF_INET;
+    if(s6 >= 0)
+        families[numFamilies++] = AF_INET6;
+
+    int started = 0;
+    info->pendingFamilies = numFamilies;
+    for(int i=0; i<numFamilies; i++) {
+        if(dht_search(id.data, 0, families[i], &DhtEngine::dhtCallback, this) >= 0)
+            started++;
+        else
+            info->pendingFamilies--;
+    }
+
+    sendQueue->flush();
+
+    if(started == 0) {
+        LOG_RATE(LOG_LEVEL_WARNING, 10, "dht_search() failed for %1", id);
+        info->pendingFamilies = 0;
+        if(not exists) {
+            searchPool.destroy(searches.remove(id));
+            Metrics::set(Metrics::ActiveSearches, searches.size());
+        }
+        return nullptr;
+    }
+
+    addOwner(info, owner);
+
+    /* The started families completed before a later one failed */
+    if(info->pendingFamilies == 0 and not info->completed)
+        searchDone(info);
+
+    return info;
+}
+
+/**
+ * Add owner to the owners of a running search without restarting it
+ */
+SearchInfo *DhtEngine::acquireSearch(const NodeId &id, QObject *owner)
+{
+    SearchInfo *info = findSearchInfo(id);
+    if(info)
+        addOwner(info, owner);
+    return info;
+}
+
+void DhtEngine::addOwner(SearchInfo *info, QObject *owner)
+{
+    if(std::find(info->owners.begin(), info->owners.end(), owner) == info->owners.end())
+        info->owners.append(owner);
+}
+
+/**
+ * Remove owner from the owners of a search. The search is removed
+ * when its last owner released it.
+ */
+void DhtEngine::releaseSearch(const NodeId &id, QObject *owner)
+{
+    SearchInfo *info = findSearchInfo(id);
+    if(not info)
+        return;
+
+    auto it = std::find(info->owners.begin(), info->owners.end(), owner);
+    if(it == info->owners.end())
+        return;
+
+    *it = info->owners.last();
+    info->owners.removeLast();
+    if(not info->owners.isEmpty())
+        return;
+
+    searchPool.destroy(searches.remove(id));
+    Metrics::set(Metrics::ActiveSearches, searches.size());
+}
+
+/**
+ * Find the SearchInfo structure belonging to a hash
+ */
+SearchInfo *DhtEngine::findSearchInfo(const NodeId &id)
+{
+    return searches.find(id);
+}
+
+/**
+ * Return a list of all active peers
+ */
+QStringList DhtEngine::getPeers(void)
+{
+    int num4 = 1024;
+    sockaddr_in sin4[num4];
+
+    int num6 = 1024;
+    sockaddr_in6 sin6[num6];
+
+    dht_get_nodes(&sin4[0], &num4, &sin6[0], &num6);
+
+    QStringList nodes;
+    for(int i=0; i<num4; i++) {
+        nodes.append(Codec::endpointToString(Endpoint::fromSockaddr(sin4[i])));
+    }
+    for(int i=0; i<num6; i++) {
+        nodes.append(Codec::endpointToString(Endpoint::fromSockaddr(sin6[i])));
+    }
+
+    return nodes;
+}
+
+/**
+ * Return the number of good nodes for both address families
+ */
+void DhtEngine::getNodeCounts(int &good4, int &good6)
+{
+    dht_nodes(AF_INET, &good4, nullptr, nullptr, nullptr);
+    dht_nodes(AF_INET6, &good6, nullptr, nullptr, nullptr);
+}
+
+int DhtEngine::pendingDatagrams(void)
+{
+    return sendQueue ? sendQueue->depth() : 0;
+}
+
+/**
+ * Set the queue used to pass events to the consumer.
+ * Must be called before the engine is moved to another thread.
+ */
+void DhtEngine::setEventQueue(EngineEventQueue *queue)
+{
+    events = queue;
+}
+
+/**
+ * Append all new results to an exporter
+ */
+void DhtEngine::setExporter(ResultExporter *exporter)
+{
+    this->exporter = exporter;
+}
+
+/**
+ * The consumer is about to drain the queue. The next event
+ * emits eventsAvailable() again.
+ */
+void DhtEngine::acknowledgeEvents(void)
+{
+    notifyPending.store(false);
+}
+
+/**
+ * Pass an event to the consumer
+ */
+void DhtEngine::publish(EngineEvent &&event)
+{
+    if(not events)
+        return;
+
+    if(backlog.isEmpty() and events->push(std::move(event))) {
+        if(not notifyPending.exchange(true))
+            emit eventsAvailable();
+        return;
+    }
+
+    backlog.append(std::move(event));
+    flushEvents();
+}
+
+/**
+ * Add a search to the next searchesChanged(). Searches change within
+ * dht_periodic, the notification is sent from the event loop once all
+ * pending input was handled.
+ */
+void DhtEngine::markChanged(SearchInfo *info)
+{
+    if(info->changed)
+        return;
+
+    info->changed = true;
+    changedSearches.append(info->id);
+    if(not changesPending) {
+        changesPending = true;
+        QMetaObject::invokeMethod(this, "notifySearches", Qt::QueuedConnection);
+    }
+}
+
+/**
+ * Report all changes since the last call in one signal. Searches
+ * cancelled in the meantime are left out. Receivers may start and
+ * cancel searches.
+ */
+void DhtEngine::notifySearches(void)
+{
+    changesPending = false;
+
+    QVector<SearchChange> changes;
+    changes.reserve(changedSearches.size());
+    for(auto &id : changedSearches) {
+        SearchInfo *info = searches.find(id);
+        if(not info or not info->changed)
+            continue;
+
+        SearchChange change;
+        change.id = id;
+        change.peers.swap(info->fresh);
+        change.completed = info->completed;
+        changes.append(std::move(change));
+
+        info->changed = false;
+        info->completed = false;
+    }
+    changedSearches.clear();
+
+    if(not changes.isEmpty())
+        emit searchesChanged(changes);
+}
+
+/**
+ * Move events from the backlog to the queue as long as there is space
+ */
+void DhtEngine::flushEvents(void)
+{
+    while(not backlog.isEmpty()) {
+        if(not events->push(std::move(backlog.first())))
+            break;
+        backlog.removeFirst();
+    }
+
+    if(not notifyPending.exchange(true))
+        emit eventsAvailable();
+}
+
+/**
+ * Compare the routing table with the last update and publish
+ * the nodes that were added and removed.
+ */
+void DhtEngine::updateNodes(void)
+{
+    int num4 = 1024;
+    sockaddr_in sin4[num4];
+
+    int num6 = 1024;
+    sockaddr_in6 sin6[num6];
+
+    dht_get_nodes(&sin4[0], &num4, &sin6[0], &num6);
+
+    QVector<Endpoint> current;
+    current.reserve(num4 + num6);
+    for(int i=0; i<num4; i++) {
+        current.append(Endpoint::fromSockaddr(sin4[i]));
+    }
+    for(int i=0; i<num6; i++) {
+        current.append(Endpoint::fromSockaddr(sin6[i]));
+    }
+    std::sort(current.begin(), current.end());
+    current.erase(std::unique(current.begin(), current.end()), current.end());
+
+    EngineEvent ev(EngineEvent::NodesChanged);
+    getNodeCounts(ev.good4, ev.good6);
+    ev.drops = quint64(drops4) + drops6;
+
+    std::set_difference(current.constBegin(), current.constEnd(),
+                        nodes.constBegin(), nodes.constEnd(),
+                        std::back_inserter(ev.added));
+    std::set_difference(nodes.constBegin(), nodes.constEnd(),
+                        current.constBegin(), current.constEnd(),
+                        std::back_inserter(ev.removed));
+    nodes.swap(current);
+
+    bool changed = not ev.added.isEmpty() or not ev.removed.isEmpty() or
+                   ev.good4 != lastGood4 or ev.good6 != lastGood6 or ev.drops != lastDrops;
+
+    lastGood4 = ev.good4;
+    lastGood6 = ev.good6;
+    lastDrops = ev.drops;
+
+    if(changed) {
+        publish(std::move(ev));
+    }
+    else if(not backlog.isEmpty()) {
+        flushEvents();
+    }
+}
+
+/**
+ * Save the routing table for the next start
+ */
+void DhtEngine::saveSnapshot(void)
+{
+    if(snapshotPath.isEmpty())
+        return;
+
+    QDir().mkpath(QFileInfo(snapshotPath).absolutePath());
+    RoutingSnapshot::save(snapshotPath);
+}
+
+/**
+ * Log the time until the routing table contains a number of good nodes
+ */
+void DhtEngine::checkWarmup(void)
+{
+    int good4, good6;
+    getNodeCounts(good4, good6);
+
+    const int steps = sizeof(warmupSteps) / sizeof(warmupSteps[0]);
+    while(warmupStep < steps and good4 + good6 >= warmupSteps[warmupStep]) {
+        qInfo() << "Reached" << warmupSteps[warmupStep] << "good nodes after"
+                << startTime.elapsed() << "ms";
+        warmupStep++;
+    }
+
+    /* Stop checking when the last step is reached or after ten minutes */
+    if(warmupStep == steps or startTime.elapsed() > 10 * 60 * 1000) {
+        warmupTimer->stop();
+    }
+}
+
+/**
+ * Update the gauges that are read from dht.c
+ */
+void DhtEngine::updateMetrics(void)
+{
+    int good4 = 0, dubious4 = 0, good6 = 0, dubious6 = 0;
+    if(s4 >= 0)
+        dht_nodes(AF_INET, &good4, &dubious4, nullptr, nullptr);
+    if(s6 >= 0)
+        dht_nodes(AF_INET6, &good6, &dubious6, nullptr, nullptr);
+
+    Metrics::set(Metrics::GoodNodes4, good4);
+    Metrics::set(Metrics::GoodNodes6, good6);
+    Metrics::set(Metrics::DubiousNodes4, dubious4);
+    Metrics::set(Metrics::DubiousNodes6, dubious6);
+    Metrics::set(Metrics::ReceiveDrops, quint64(drops4) + drops6);
+
+    admission_stats stats;
+    admission_get_stats(&stats);
+    Metrics::add(Metrics::DroppedBlocked, stats.blocked - lastAdmission.blocked);
+    Metrics::add(Metrics::DroppedRateLimited, stats.limited - lastAdmission.limited);
+    lastAdmission = stats;
+
+    auto &r = reactor->stats();
+    Metrics::add(Metrics::ReactorWaits, r.waits - lastReactor.waits);
+    Metrics::add(Metrics::TimerArms, r.timerArms - lastReactor.timerArms);
+    lastReactor = r;
+
+    auto &q = sendQueue->stats();
+    Metrics::set(Metrics::SendQueueDepth, sendQueue->depth());
+    Metrics::set(Metrics::UniquePeers, PeerTable::global().size());
+    Metrics::set(Metrics::PeerTableBytes, PeerTable::global().memoryUsage());
+    Metrics::add(Metrics::DatagramsOut4, q.sent4 - lastSend.sent4);
+    Metrics::add(Metrics::DatagramsOut6, q.sent6 - lastSend.sent6);
+    Metrics::add(Metrics::BytesOut4, q.bytes4 - lastSend.bytes4);
+    Metrics::add(Metrics::BytesOut6, q.bytes6 - lastSend.bytes6);
+    Metrics::add(Metrics::SendDropped, q.dropped - lastSend.dropped);
+    Metrics::add(Metrics::SendErrors, q.errors - lastSend.errors);
+    Metrics::add(Metrics::SendRetries, q.retries - lastSend.retries);
+    Metrics::add(Metrics::SendCalls, q.calls - lastSend.calls);
+    lastSend = q;
+}
+
+/**
+ * Called by dht.c instead of sendto()
+ */
+ssize_t DhtEngine::queuedSend(int s, const void *buf, size_t len, int flags,
+                              const sockaddr *to, socklen_t tolen)
+{
+    Q_UNUSED(flags);
+    return outbound->enqueue(s, buf, len, to, tolen);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QSocketNotifier>
+#include <QSettings>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QSet>
+#include <QStringList>
+#include <QVector>
+#include <QVarLengthArray>
+#include <atomic>
+
+#include "admission.h"
+#include "endpoint.h"
+#include "nodeid.h"
+#include "peeridset.h"
+#include "pool.h"
+#include "peertable.h"
+#include "reactor.h"
+#include "recvbatch.h"
+#include "resultexporter.h"
+#include "searchregistry.h"
+#include "sendqueue.h"
+#include "spscqueue.h"
+
+
+/* For QSet and QHash, nodeid.h doesn't depend on Qt */
+inline uint qHash(const NodeId &id, uint seed = 0)
+{
+    return uint(id.hash()) ^ seed;
+}
+
+/**
+ * State of a search. Allocated from the engine's pool, the pointer
+ * is valid until the last owner released the search. The slot is then
+ * reused for another search right away, so users keep the id and look
+ * the search up with DhtEngine::findSearchInfo() instead of keeping
+ * the pointer.
+ */
+struct SearchInfo
+{
+    explicit SearchInfo(const NodeId &id) :
+        id(id),
+        pendingFamilies(0),
+        changed(false),
+        completed(false)
+    { }
+
+    NodeId id;                  /* Hash that is being searched */
+    PeerIdSet results;          /* Adresses discovered, as ids in PeerTable::global() */
+    int pendingFamilies;        /* Address families still searching */
+    QVarLengthArray<QObject *, 2> owners;   /* Users of the search, see DhtEngine::startSearch() */
+
+    /* Changes since the last DhtEngine::searchesChanged() */
+    std::vector<uint32_t> fresh;    /* New results */
+    bool changed;               /* The search is in the list of changed searches */
+    bool completed;             /* The search completed */
+};
+
+/**
+ * What happened to one search since the last notification
+ */
+struct SearchChange
+{
+    NodeId id;
+    std::vector<uint32_t> peers;    /* New results, as ids in PeerTable::global() */
+    bool completed;             /* The search completed */
+};
+
+/**
+ * Notification from the engine to the user interface
+ */
+struct EngineEvent
+{
+    enum Type {
+        None,
+        SearchValues,       /* New results for a search */
+        SearchDone,         /* A search completed */
+        NodesChanged,       /* Routing table changed */
+    };
+
+    EngineEvent(Type type = None) :
+        type(type),
+        good4(0),
+        good6(0),
+        drops(0)
+    { }
+
+    Type type;
+    QByteArray hash;        /* Hash of the search */
+    QVector<Endpoint> peers;    /* New results */
+    QVector<Endpoint> added;    /* Nodes added to the routing table, sorted */
+    QVector<Endpoint> removed;  /* Nodes removed from the routing table, sorted */
+    int good4;              /* Number of good IPv4 nodes */
+    int good6;              /* Number of good IPv6 nodes */
+    quint64 drops;          /* Datagrams dropped by the kernel */
+};
+
+typedef SpscQueue<EngineEvent, 4096> EngineEventQueue;
+
+/**
+ * Owns the DHT sockets and drives dht_periodic from the event loop.
+ * Doesn't depend on QtWidgets, so it can run on a QCoreApplication.
+ *
+ * The engine may live on its own thread. All DHT functions must then be
+ * called from that thread, other threads use queued calls to the slots
+ * and receive updates through the event queue.
+ */
+class DhtEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit DhtEngine(QObject *parent = 0);
+    ~DhtEngine();
+
+    void setEventQueue(EngineEventQueue *queue);
+    void acknowledgeEvents(void);   /* Called by the consumer before draining the queue */
+    void setExporter(ResultExporter *exporter);
+    void setConfigFile(const QString &path);
+    void setPort(int port);
+    void setSendRate(unsigned rate);
+    void setNodeId(const NodeId &id);
+    void deliver(const char *data, int length, const sockaddr *from, socklen_t fromlen);
+
+    SearchInfo *findSearchInfo(const NodeId &id);
+    SearchInfo *startSearch(const NodeId &id, QObject *owner);  /* Returns null if the search can't be started */
+    SearchInfo *acquireSearch(const NodeId &id, QObject *owner);    /* Returns null if there is no search */
+    void releaseSearch(const NodeId &id, QObject *owner);
+    QStringList getPeers(void);     /* Get the list of peers */
+    void getNodeCounts(int &good4, int &good6);
+    int pendingDatagrams(void);     /* Datagrams waiting in the send queue */
+
+public slots:
+    bool init();
+    void search(const QByteArray &hash);        /* Start or restart a search */
+    void removeSearch(const QByteArray &hash);  /* Forget about a search */
+
+signals:
+    void eventsAvailable();         /* The event queue is no longer empty */
+    void searchesChanged(const QVector<SearchChange> &changes); /* Once per event loop iteration */
+
+private slots:
+    void reactorActivated(void);    /* A socket or the timer is ready */
+    void updateNodes(void);         /* Publish changes of the routing table */
+    void saveSnapshot(void);        /* Write the routing table snapshot */
+    void checkWarmup(void);         /* Log how fast the routing table fills */
+    void updateMetrics(void);       /* Update the node count gauges */
+    void notifySearches(void);      /* Emit searchesChanged() */
+
+private:
+    static void dhtCallback(void *engine, int event, const unsigned char *info_hash,
+                  const void *data, size_t data_len);
+    static ssize_t queuedSend(int s, const void *buf, size_t len, int flags,
+                              const sockaddr *to, socklen_t tolen);
+
+    void socketActivated(int s);
+    void timerActivated(void);
+    void scheduleNext(int rc, time_t tosleep);
+
+    void searchDone(SearchInfo *info);
+    void addOwner(SearchInfo *info, QObject *owner);
+    void markChanged(SearchInfo *info);
+    void publish(EngineEvent &&event);
+    void flushEvents(void);
+
+    int s4;                 /* Descriptor for IPv4 socket */
+    int s6;                 /* Descriptor for IPv6 socket */
+    Reactor *reactor;       /* Sockets and the timer to call dht_periodic */
+    QSocketNotifier *reactorNotifier;   /* Notifier for the reactor descriptor */
+    int periodicTimer;      /* Reactor timer to call dht_periodic */
+    SendQueue *sendQueue;   /* Outgoing datagrams */
+    QTimer *nodeTimer;      /* Timer to publish routing table changes */
+    QTimer *snapshotTimer;  /* Timer to save the routing table */
+    QTimer *warmupTimer;    /* Timer to check the number of good nodes after the start */
+    QTimer *metricsTimer;   /* Timer to update the metrics gauges */
+    QElapsedTimer startTime;
+    int warmupStep;         /* Next number of good nodes to report */
+    QString snapshotPath;
+    RecvBatch *recvBatch;   /* Receive buffers for both sockets */
+    quint64 wakeups;        /* Number of socket activations */
+    quint64 datagrams;      /* Number of datagrams received */
+    quint32 drops4;         /* Datagrams dropped on the IPv4 socket */
+    quint32 drops6;         /* Datagrams dropped on the IPv6 socket */
+
+    EngineEventQueue *events;       /* Queue to the consumer, may be null */
+    ResultExporter *exporter;       /* Export of new results, may be null */
+    QList<EngineEvent> backlog;     /* Events that didn't fit into the queue */
+    std::atomic<bool> notifyPending;
+    QVector<Endpoint> nodes;        /* Routing table at the last update, sorted */
+    int lastGood4;                  /* Node counts at the last update */
+    int lastGood6;
+    quint64 lastDrops;
+    admission_stats lastAdmission;  /* Admission filter counters at the last metrics update */
+    Reactor::Stats lastReactor;     /* Reactor counters at the last metrics update */
+    SendQueue::Stats lastSend;      /* Send queue counters at the last metrics update */
+
+    Pool<SearchInfo> searchPool;    /* Storage of the searches */
+    SearchRegistry<SearchInfo> searches;    /* Active searches by info hash */
+    QVector<NodeId> changedSearches;    /* Searches to report in the next searchesChanged() */
+    bool changesPending;            /* notifySearches() is queued */
+    QString configFile;             /* Configuration file, empty for the default */
+    int portOverride;               /* Port given on the command line, 0 if none */
+    unsigned sendRateOverride;      /* Send rate given on the command line, 0 if none */
+    NodeId overrideID;              /* Node ID given on the command line */
+    bool idOverride;
+    QSettings *settings;
+    unsigned char *myID;
+};
@@ -0,0 +1,251 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * dht.c keeps the routing table in static variables. It is compiled
+ * as part of this file instead of on its own, so the functions below
+ * can read it. Its calls to sendto() are redirected as well, to count
+ * the datagrams it sends and to replace the network in benchmarks.
+ *
+ * Everything else dht.c takes from outside goes through this file too,
+ * the public functions, the clock, random numbers and the filter. That
+ * is all the input capture.c needs to replay a session.
+ */
+/* dht.c uses memmem(), the headers below must see this first */
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include "dhtinternal.h"
+#include "capture.h"
+
+int dht_random_bytes(void *buf, size_t size);
+int dht_blacklisted(const struct sockaddr *sa, int salen);
+
+static dht_send_function *send_function = NULL;
+static dht_clock_function *clock_function = NULL;
+static dht_random_function *random_function = NULL;
+static dht_filter_function *filter_function = NULL;
+static dht_seen_function *seen_function = NULL;
+
+static struct timeval call_time;    /* Time dht.c sees during the current call */
+static uint32_t filter_calls;       /* Calls of dht_blacklisted() during the current call */
+static uint64_t random_state = 0x9e3779b97f4a7c15ULL;
+
+/* dht.c calls this instead of sendto() */
+static ssize_t dht_internal_sendto(int s, const void *buf, size_t len, int flags,
+                                   const struct sockaddr *to, socklen_t tolen)
+{
+    if(send_function)
+        return send_function(s, buf, len, flags, to, tolen);
+    return sendto(s, buf, len, flags, to, tolen);
+}
+
+/* The clock stands still during a call, see begin_call() */
+static int dht_internal_gettimeofday(struct timeval *tv, void *tz)
+{
+    (void) tz;
+    *tv = call_time;
+    return 0;
+}
+
+/* random() with its own state, seeded in dht_init() (xorshift64*) */
+static long dht_internal_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return (long) ((random_state * 0x2545f4914f6cdd1dULL) >> 33);
+}
+
+static int dht_internal_random_bytes(void *buf, size_t size)
+{
+    int rc;
+
+    if(random_function)
+        rc = random_function(buf, size);
+    else
+        rc = dht_random_bytes(buf, size);
+
+    if(rc >= 0 && capture_active())
+        capture_write(CAPTURE_RANDOM, NULL, 0, buf, size, NULL);
+    return rc;
+}
+
+static int dht_internal_blacklisted(const struct sockaddr *sa, int salen)
+{
+    uint32_t index = filter_calls++;
+    int rc;
+
+    if(filter_function)
+        rc = filter_function(sa, salen);
+    else
+        rc = dht_blacklisted(sa, salen);
+
+    if(rc && capture_active())
+        capture_write(CAPTURE_BLOCKED, sa, salen, &index, sizeof(index), NULL);
+    else if(!rc && seen_function)
+        seen_function(sa, salen);
+    return rc;
+}
+
+#define sendto dht_internal_sendto
+#define gettimeofday dht_internal_gettimeofday
+#define random dht_internal_random
+#define dht_random_bytes dht_internal_random_bytes
+#define dht_blacklisted dht_internal_blacklisted
+#define dht_init dht_init_unwrapped
+#define dht_periodic dht_periodic_unwrapped
+#define dht_search dht_search_unwrapped
+#define dht_ping_node dht_ping_node_unwrapped
+#define dht_insert_node dht_insert_node_unwrapped
+#include "dht/dht.c"
+#undef sendto
+#undef gettimeofday
+#undef random
+#undef dht_random_bytes
+#undef dht_blacklisted
+#undef dht_init
+#undef dht_periodic
+#undef dht_search
+#undef dht_ping_node
+#undef dht_insert_node
+
+
+/*
+ * Entry points of dht.c. Each call is recorded if a capture is open and
+ * fixes the time dht.c sees until the next call.
+ */
+static void begin_call(int type, const struct sockaddr *sa, int salen,
+                       const void *data, size_t len)
+{
+    filter_calls = 0;
+
+    if(clock_function)
+        clock_function(&call_time);
+    else if(capture_active())
+        capture_write(type, sa, salen, data, len, &call_time);
+    else
+        gettimeofday(&call_time, NULL);
+}
+
+int dht_init(int s, int s6, const unsigned char *id, const unsigned char *v)
+{
+    unsigned char data[25];
+
+    memcpy(data, id, 20);
+    if(v)
+        memcpy(data + 20, v, 4);
+    else
+        memset(data + 20, 0, 4);
+    data[24] = (s >= 0 ? 1 : 0) | (s6 >= 0 ? 2 : 0);
+    begin_call(CAPTURE_INIT, NULL, 0, data, sizeof(data));
+
+    if(dht_internal_random_bytes(&random_state, sizeof(random_state)) < 0 || random_state == 0)
+        random_state = 0x9e3779b97f4a7c15ULL;
+
+    return dht_init_unwrapped(s, s6, id, v);
+}
+
+int dht_periodic(const void *buf, size_t buflen,
+                 const struct sockaddr *from, int fromlen,
+                 time_t *tosleep, dht_callback *callback, void *closure)
+{
+    begin_call(CAPTURE_PERIODIC, buflen > 0 ? from : NULL, fromlen, buf, buflen);
+    return dht_periodic_unwrapped(buf, buflen, from, fromlen, tosleep, callback, closure);
+}
+
+int dht_search(const unsigned char *id, int port, int af,
+               dht_callback *callback, void *closure)
+{
+    unsigned char data[23];
+    uint16_t p = port;
+
+    memcpy(data, id, 20);
+    memcpy(data + 20, &p, 2);
+    data[22] = af == AF_INET6 ? 6 : 4;
+    begin_call(CAPTURE_SEARCH, NULL, 0, data, sizeof(data));
+    return dht_search_unwrapped(id, port, af, callback, closure);
+}
+
+int dht_ping_node(const struct sockaddr *sa, int salen)
+{
+    begin_call(CAPTURE_PING, sa, salen, NULL, 0);
+    return dht_ping_node_unwrapped((struct sockaddr *) sa, salen);
+}
+
+int dht_insert_node(const unsigned char *id, struct sockaddr *sa, int salen)
+{
+    begin_call(CAPTURE_INSERT, sa, salen, id, 20);
+    return dht_insert_node_unwrapped(id, sa, salen);
+}
+
+
+int dht_internal_foreach_node(dht_node_callback *f, void *closure)
+{
+    struct bucket *b;
+    struct node *n;
+    int count = 0;
+
+    for(b = buckets; b; b = b->next) {
+        for(n = b->nodes; n; n = n->next) {
+            f(closure, n->id, (struct sockaddr *) &n->ss, n->sslen, n->time, n->reply_time);
+            count++;
+        }
+    }
+
+    for(b = buckets6; b; b = b->next) {
+        for(n = b->nodes; n; n = n->next) {
+            f(closure, n->id, (struct sockaddr *) &n->ss, n->sslen, n->time, n->reply_time);
+            count++;
+        }
+    }
+
+    return count;
+}
+
+void dht_internal_set_send_function(dht_send_function *f)
+{
+    send_function = f;
+}
+
+void dht_internal_get_call_time(struct timeval *tv)
+{
+    *tv = call_time;
+}
+
+void dht_internal_set_clock_function(dht_clock_function *f)
+{
+    clock_function = f;
+}
+
+void dht_internal_set_random_function(dht_random_function *f)
+{
+    random_function = f;
+}
+
+void dht_internal_set_filter_function(dht_filter_function *f)
+{
+    filter_function = f;
+}
+
+void dht_internal_set_seen_function(dht_seen_function *f)
+{
+    seen_function = f;
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <sys/time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Access to state that dht.c doesn't export
+ */
+
+typedef void dht_node_callback(void *closure, const unsigned char *id,
+                               const struct sockaddr *sa, int salen,
+                               time_t time, time_t reply_time);
+
+/* Call f for every node in the IPv4 and IPv6 routing tables.
+ * Returns the number of nodes. */
+int dht_internal_foreach_node(dht_node_callback *f, void *closure);
+
+typedef ssize_t dht_send_function(int s, const void *buf, size_t len, int flags,
+                                  const struct sockaddr *to, socklen_t tolen);
+
+/* Send datagrams with f instead of sendto(), null restores sendto() */
+void dht_internal_set_send_function(dht_send_function *f);
+
+/*
+ * Replacements for the input of dht.c, used to replay a capture.
+ * Null restores the default.
+ */
+
+/* Time dht.c saw during the last call */
+void dht_internal_get_call_time(struct timeval *tv);
+
+typedef void dht_clock_function(struct timeval *tv);
+
+/* Called at the start of every call into dht.c, dht.c sees the time
+ * it returns until the call ends. The default is gettimeofday(). */
+void dht_internal_set_clock_function(dht_clock_function *f);
+
+typedef int dht_random_function(void *buf, size_t size);
+
+/* Replaces dht_random_bytes() */
+void dht_internal_set_random_function(dht_random_function *f);
+
+typedef int dht_filter_function(const struct sockaddr *sa, int salen);
+
+/* Replaces dht_blacklisted() */
+void dht_internal_set_filter_function(dht_filter_function *f);
+
+typedef void dht_seen_function(const struct sockaddr *sa, int salen);
+
+/* Call f for every address that passed the filter: the source of every
+ * incoming datagram and every node dht.c learned from a reply */
+void dht_internal_set_seen_function(dht_seen_function *f);
+
+#ifdef __cplusplus
+}
+#endif
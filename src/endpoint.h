@@ -0,0 +1,154 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+#include <QHash>
+
+
+/**
+ * Packed UDP endpoint. IPv4 addresses use the first four bytes of addr.
+ * Endpoints are ordered by family, address and port.
+ */
+struct Endpoint
+{
+    unsigned char family;       /* 4 or 6 */
+    unsigned char addr[16];     /* Address in network byte order */
+    unsigned char port[2];      /* Port in network byte order */
+
+    Endpoint()
+    {
+        memset(this, 0, sizeof(*this));
+    }
+
+    /**
+     * Read an endpoint in compact format, 6 bytes for IPv4
+     * and 18 bytes for IPv6.
+     */
+    static Endpoint fromCompact4(const unsigned char *data)
+    {
+        Endpoint e;
+        e.family = 4;
+        memcpy(e.addr, data, 4);
+        memcpy(e.port, data + 4, 2);
+        return e;
+    }
+
+    static Endpoint fromCompact6(const unsigned char *data)
+    {
+        Endpoint e;
+        e.family = 6;
+        memcpy(e.addr, data, 16);
+        memcpy(e.port, data + 16, 2);
+        return e;
+    }
+
+    static Endpoint fromSockaddr(const sockaddr_in &sin)
+    {
+        return fromAddress(AF_INET, &sin.sin_addr, sin.sin_port);
+    }
+
+    static Endpoint fromSockaddr(const sockaddr_in6 &sin6)
+    {
+        return fromAddress(AF_INET6, &sin6.sin6_addr, sin6.sin6_port);
+    }
+
+    int portNumber() const
+    {
+        return (port[0] << 8) | port[1];
+    }
+
+    /**
+     * Fill in a socket address, returns its length
+     */
+    socklen_t toSockaddr(sockaddr_storage &ss) const
+    {
+        memset(&ss, 0, sizeof(ss));
+        if(family == 4) {
+            auto sin = (sockaddr_in *) &ss;
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, addr, 4);
+            memcpy(&sin->sin_port, port, 2);
+            return sizeof(sockaddr_in);
+        }
+        auto sin6 = (sockaddr_in6 *) &ss;
+        sin6->sin6_family = AF_INET6;
+        memcpy(&sin6->sin6_addr, addr, 16);
+        memcpy(&sin6->sin6_port, port, 2);
+        return sizeof(sockaddr_in6);
+    }
+
+    bool isNull() const
+    {
+        return family == 0;
+    }
+
+    /**
+     * Hash value for tables, mixes all bytes of the endpoint
+     */
+    size_t hash() const
+    {
+        const unsigned char *p = (const unsigned char *) this;
+        uint64_t a, b;
+        memcpy(&a, p, 8);
+        memcpy(&b, p + 8, 8);
+        uint64_t h = a ^ (b * 0x9e3779b97f4a7c15ULL) ^ (p[16] << 16 | p[17] << 8 | p[18]);
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    bool operator==(const Endpoint &other) const
+    {
+        return memcmp(this, &other, sizeof(*this)) == 0;
+    }
+
+    bool operator!=(const Endpoint &other) const
+    {
+        return not (*this == other);
+    }
+
+    bool operator<(const Endpoint &other) const
+    {
+        return memcmp(this, &other, sizeof(*this)) < 0;
+    }
+
+private:
+    static Endpoint fromAddress(int af, const void *a, in_port_t p)
+    {
+        Endpoint e;
+        e.family = (af == AF_INET) ? 4 : 6;
+        memcpy(e.addr, a, (af == AF_INET) ? 4 : 16);
+        memcpy(e.port, &p, 2);
+        return e;
+    }
+};
+
+static_assert(sizeof(Endpoint) == 19, "Endpoint must not contain padding");
+
+inline uint qHash(const Endpoint &e, uint seed = 0)
+{
+    return qHashBits(&e, sizeof(e), seed);
+}
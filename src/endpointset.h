@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "endpoint.h"
+
+
+/**
+ * Flat hash set of endpoints. The endpoints are stored directly in the
+ * table, empty slots have a null family. Each peer takes 19 bytes of
+ * table space, with a load factor between 3/8 and 3/4.
+ */
+class EndpointSet
+{
+public:
+    EndpointSet() :
+        used(0)
+    { }
+
+    /**
+     * Insert an endpoint. Returns true if it wasn't in the set.
+     */
+    bool insert(const Endpoint &e)
+    {
+        if(4 * (used + 1) > 3 * table.size())
+            grow();
+
+        size_t mask = table.size() - 1;
+        for(size_t i = e.hash() & mask; ; i = (i + 1) & mask) {
+            if(table[i].isNull()) {
+                table[i] = e;
+                used++;
+                return true;
+            }
+            if(table[i] == e)
+                return false;
+        }
+    }
+
+    bool contains(const Endpoint &e) const
+    {
+        if(table.empty())
+            return false;
+
+        size_t mask = table.size() - 1;
+        for(size_t i = e.hash() & mask; ; i = (i + 1) & mask) {
+            if(table[i].isNull())
+                return false;
+            if(table[i] == e)
+                return true;
+        }
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    /**
+     * Bytes allocated for the table
+     */
+    size_t memoryUsage() const
+    {
+        return table.capacity() * sizeof(Endpoint);
+    }
+
+    template<typename F>
+    void forEach(F f) const
+    {
+        for(auto &e : table) {
+            if(not e.isNull())
+                f(e);
+        }
+    }
+
+private:
+    void grow(void)
+    {
+        std::vector<Endpoint> old(table.empty() ? 16 : table.size() * 2);
+        old.swap(table);
+        used = 0;
+        for(auto &e : old) {
+            if(not e.isNull())
+                insert(e);
+        }
+    }
+
+    std::vector<Endpoint> table;    /* Size is zero or a power of two */
+    size_t used;
+};
@@ -18,7 +18,8 @@
 #pragma once
 
 #include <QValidator>
-#include <QByteArray>
+
+#include "codec.h"
 
 
 class HashValidator : public QValidator
@@ -34,20 +35,20 @@ public:
 
     virtual State validate(QString &input, int &pos) const
     {
-        auto low = input.toLower();
-        for(int i=0; i<low.size(); i++) {
-            if(low[i] < '0' or low[i] > 'f') {
+        for(int i=0; i<input.size(); i++) {
+            ushort c = input[i].unicode();
+            if(c > 0x7f or Codec::hexValue(c) < 0) {
                 emit validityChanged(false);
                 return Invalid;
             }
         }
 
-        if(low.size() < 40) {
+        if(input.size() < Codec::idLength) {
             emit validityChanged(false);
             return Intermediate;
         }
 
-        if(low.size() > 40) {
+        if(input.size() > Codec::idLength) {
             return Invalid;
         }
 
@@ -0,0 +1,200 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstdio>
+#include <ctime>
+
+#include "logger.h"
+#include "codec.h"
+
+
+std::atomic<int> Logger::minLevel(LOG_MIN_LEVEL);
+std::atomic<quint64> Logger::dropped(0);
+QMutex Logger::lock;
+QVector<Logger::Ring *> Logger::rings;
+Logger *Logger::instance = nullptr;
+
+static const char *levelNames[] = { "trace", "debug", "info", "warning", "error" };
+
+
+/**
+ * Start the background thread. Records written before are kept
+ * until the rings are full.
+ */
+void Logger::start(void)
+{
+    if(instance)
+        return;
+
+    instance = new Logger;
+    instance->running = true;
+    instance->QThread::start(QThread::LowPriority);
+}
+
+void Logger::stop(void)
+{
+    if(not instance)
+        return;
+
+    instance->running = false;
+    instance->wait();
+    delete instance;
+    instance = nullptr;
+}
+
+void Logger::setLevel(int level)
+{
+    minLevel.store(qMax(level, LOG_MIN_LEVEL), std::memory_order_relaxed);
+}
+
+/**
+ * Set the level by name. Returns false for unknown names.
+ */
+bool Logger::setLevel(const QString &name)
+{
+    for(int i=0; i<int(sizeof(levelNames) / sizeof(levelNames[0])); i++) {
+        if(name == levelNames[i]) {
+            setLevel(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+quint64 Logger::now(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return quint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Ring of the calling thread, registered on first use
+ */
+Logger::Ring *Logger::ring(void)
+{
+    static thread_local Ring *local = nullptr;
+    if(not local) {
+        local = new Ring;
+        QMutexLocker locker(&lock);
+        rings.append(local);
+    }
+    return local;
+}
+
+void Logger::push(LogRecord &&r)
+{
+    if(not ring()->push(std::move(r)))
+        dropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+static void appendArg(QByteArray &out, const LogArg &a)
+{
+    switch(a.type) {
+    case LogArg::Int:
+        out.append(QByteArray::number(a.i));
+        break;
+    case LogArg::UInt:
+        out.append(QByteArray::number(a.u));
+        break;
+    case LogArg::Double:
+        out.append(QByteArray::number(a.d));
+        break;
+    case LogArg::String:
+        out.append(a.text);
+        break;
+    case LogArg::Hex: {
+        int n = out.size();
+        out.resize(n + 2 * a.length);
+        Codec::encodeHex(a.bytes, a.length, out.data() + n);
+        break;
+    }
+    }
+}
+
+/**
+ * Format a record as "<seconds> <level> <message>", %1 to %4 in
+ * the message are replaced by the arguments.
+ */
+void Logger::format(QByteArray &out, const LogRecord &r)
+{
+    char prefix[48];
+    snprintf(prefix, sizeof(prefix), "%llu.%06llu %s ",
+             (unsigned long long) (r.time / 1000000000),
+             (unsigned long long) (r.time % 1000000000 / 1000),
+             levelNames[r.level]);
+    out.append(prefix);
+
+    for(const char *p = r.format; *p; p++) {
+        if(p[0] == '%' and p[1] >= '1' and p[1] < '1' + r.numArgs) {
+            appendArg(out, r.args[p[1] - '1']);
+            p++;
+        }
+        else {
+            out.append(*p);
+        }
+    }
+
+    if(r.suppressed > 0) {
+        out.append(" (");
+        out.append(QByteArray::number(r.suppressed));
+        out.append(" similar messages suppressed)");
+    }
+    out.append('\n');
+}
+
+bool Logger::drain(void)
+{
+    QVector<Ring *> current;
+    {
+        QMutexLocker locker(&lock);
+        current = rings;
+    }
+
+    QByteArray out;
+    LogRecord r;
+    for(auto ring : current) {
+        while(ring->pop(r))
+            format(out, r);
+    }
+
+    quint64 lost = dropped.exchange(0, std::memory_order_relaxed);
+    if(lost > 0) {
+        out.append(QByteArray::number(lost));
+        out.append(" log records dropped\n");
+    }
+
+    if(out.isEmpty())
+        return false;
+
+    fwrite(out.constData(), 1, out.size(), stderr);
+    fflush(stderr);
+    return true;
+}
+
+/**
+ * Poll the rings. Producers never wake the thread, so logging
+ * doesn't cost a system call.
+ */
+void Logger::run(void)
+{
+    while(running) {
+        if(not drain())
+            msleep(20);
+    }
+    drain();
+}
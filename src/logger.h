@@ -0,0 +1,256 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QMutex>
+#include <QVector>
+#include <QByteArray>
+#include <QString>
+#include <atomic>
+#include <cstring>
+
+#include "nodeid.h"
+#include "spscqueue.h"
+
+
+/* Log levels, also usable in preprocessor conditions */
+#define LOG_LEVEL_TRACE     0
+#define LOG_LEVEL_DEBUG     1
+#define LOG_LEVEL_INFO      2
+#define LOG_LEVEL_WARNING   3
+#define LOG_LEVEL_ERROR     4
+
+/* Levels below LOG_MIN_LEVEL are removed at compile time */
+#ifndef LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define LOG_MIN_LEVEL LOG_LEVEL_INFO
+#else
+#define LOG_MIN_LEVEL LOG_LEVEL_TRACE
+#endif
+#endif
+
+
+/**
+ * Single argument of a log record. The record is formatted later on the
+ * logger thread, so nothing is stored by pointer: strings are copied up
+ * to maxText - 1 bytes, and byte arrays are copied and printed in hex,
+ * see hex().
+ */
+struct LogArg
+{
+    enum Type {
+        Int,
+        UInt,
+        Double,
+        String,
+        Hex,
+    };
+
+    static const int maxText = 32;
+
+    Type type;
+    unsigned char length;       /* Number of bytes for Hex */
+    union {
+        qint64 i;
+        quint64 u;
+        double d;
+        char text[maxText];     /* Null-terminated, longer strings are cut */
+        unsigned char bytes[NodeId::size];
+    };
+
+    LogArg() : type(Int), length(0), i(0) { }
+    LogArg(int v) : type(Int), length(0), i(v) { }
+    LogArg(long v) : type(Int), length(0), i(v) { }
+    LogArg(long long v) : type(Int), length(0), i(v) { }
+    LogArg(unsigned int v) : type(UInt), length(0), u(v) { }
+    LogArg(unsigned long v) : type(UInt), length(0), u(v) { }
+    LogArg(unsigned long long v) : type(UInt), length(0), u(v) { }
+    LogArg(double v) : type(Double), length(0), d(v) { }
+
+    LogArg(const char *v) : type(String), length(0)
+    {
+        if(not v)
+            v = "(null)";
+        size_t n = strnlen(v, maxText - 1);
+        memcpy(text, v, n);
+        text[n] = '\0';
+    }
+
+    LogArg(const NodeId &id) : type(Hex), length(NodeId::size)
+    {
+        memcpy(bytes, id.data, NodeId::size);
+    }
+
+    /**
+     * Print the first 20 bytes of a in hex, the rest is cut. Byte arrays
+     * must be passed through hex(), so the cut is never silent.
+     */
+    static LogArg hex(const QByteArray &a)
+    {
+        LogArg arg;
+        arg.type = Hex;
+        arg.length = qMin(a.size(), int(sizeof(arg.bytes)));
+        memcpy(arg.bytes, a.constData(), arg.length);
+        return arg;
+    }
+
+    LogArg(const QByteArray &a) = delete;
+};
+
+/**
+ * Binary log record, formatted on the logger thread
+ */
+struct LogRecord
+{
+    static const int maxArgs = 4;
+
+    quint64 time;               /* ns since the start of the logger */
+    const char *format;         /* Literal, %1 to %4 are replaced by the arguments */
+    int level;
+    int numArgs;
+    quint32 suppressed;         /* Records dropped by rate limiting before this one */
+    LogArg args[maxArgs];
+};
+
+/**
+ * Asynchronous logger.
+ *
+ * Every thread writes records into its own lock-free ring, a background
+ * thread formats them and writes them to stderr. Formatting the arguments,
+ * including hex encoding of hashes, happens only on the background thread.
+ * If a ring is full, records are dropped and counted instead of blocking
+ * the caller.
+ *
+ * Use the LOG_* macros. Disabled levels cost a branch at runtime, levels
+ * below LOG_MIN_LEVEL are removed by the compiler.
+ */
+class Logger : public QThread
+{
+    Q_OBJECT
+
+public:
+    static void start(void);
+    static void stop(void);     /* Write the remaining records and stop the thread */
+
+    static void setLevel(int level);
+    static bool setLevel(const QString &name);
+
+    static bool enabled(int level)
+    {
+        return level >= minLevel.load(std::memory_order_relaxed);
+    }
+
+    template<typename... Args>
+    static void write(int level, quint32 suppressed, const char *format, const Args&... args)
+    {
+        static_assert(sizeof...(Args) <= LogRecord::maxArgs, "Too many log arguments");
+
+        LogRecord r;
+        r.time = now();
+        r.format = format;
+        r.level = level;
+        r.numArgs = sizeof...(Args);
+        r.suppressed = suppressed;
+        assign(r.args, args...);
+        push(std::move(r));
+    }
+
+    /**
+     * Rate limit for a call site, at most limit records per second
+     */
+    struct RateLimit
+    {
+        RateLimit() : window(0), count(0), suppressed(0) { }
+
+        bool allow(quint32 limit, quint32 &dropped)
+        {
+            quint64 t = now() / 1000000000;
+            if(t != window) {
+                window = t;
+                count = 0;
+            }
+            if(count >= limit) {
+                suppressed++;
+                return false;
+            }
+            count++;
+            dropped = suppressed;
+            suppressed = 0;
+            return true;
+        }
+
+        quint64 window;
+        quint32 count;
+        quint32 suppressed;
+    };
+
+protected:
+    void run(void) override;
+
+private:
+    typedef SpscQueue<LogRecord, 1024> Ring;
+
+    static void assign(LogArg *) { }
+
+    template<typename T, typename... Rest>
+    static void assign(LogArg *out, const T &first, const Rest&... rest)
+    {
+        *out = LogArg(first);
+        assign(out + 1, rest...);
+    }
+
+    static quint64 now(void);
+    static void push(LogRecord &&r);
+    static Ring *ring(void);
+    static void format(QByteArray &out, const LogRecord &r);
+    bool drain(void);           /* Write all pending records, true if there were any */
+
+    static std::atomic<int> minLevel;
+    static std::atomic<quint64> dropped;
+    static QMutex lock;                 /* Protects the list of rings */
+    static QVector<Ring *> rings;       /* Never freed, threads are long-lived */
+    static Logger *instance;
+
+    std::atomic<bool> running;
+};
+
+
+/* The format must be a string literal, "" makes anything else an error */
+#define LOG_AT(lvl, ...) \
+    do { \
+        if((lvl) >= LOG_MIN_LEVEL and Logger::enabled(lvl)) \
+            Logger::write((lvl), 0, "" __VA_ARGS__); \
+    } while(0)
+
+/* Log at most perSecond records per second and thread from this call site */
+#define LOG_RATE(lvl, perSecond, ...) \
+    do { \
+        if((lvl) >= LOG_MIN_LEVEL and Logger::enabled(lvl)) { \
+            static thread_local Logger::RateLimit limit_; \
+            quint32 suppressed_; \
+            if(limit_.allow((perSecond), suppressed_)) \
+                Logger::write((lvl), suppressed_, "" __VA_ARGS__); \
+        } \
+    } while(0)
+
+#define LOG_TRACE(...)      LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...)      LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)       LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARNING(...)    LOG_AT(LOG_LEVEL_WARNING, __VA_ARGS__)
+#define LOG_ERROR(...)      LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
@@ -16,27 +16,408 @@
  */
 
 #include <QApplication>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QSocketNotifier>
 #include <QSystemTrayIcon>
 #include <QDebug>
+#include <QFile>
 #include <unistd.h>
+#include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
 #include "mainwindow.h"
+#include "dhtengine.h"
+#include "batchsearch.h"
+#include "swarmmonitor.h"
+#include "crawler.h"
+#include "controlserver.h"
+#include "resultexporter.h"
+#include "shardsupervisor.h"
+#include "metricsserver.h"
+#include "logger.h"
+#include "capture.h"
+#include "codec.h"
 
 
-int main(int argc, char *argv[])
+static int signalPipe[2];
+
+/**
+ * Forward SIGINT and SIGTERM to the event loop.
+ */
+static void signalHandler(int sig)
+{
+    char c = sig;
+    (void) ::write(signalPipe[1], &c, 1);
+}
+
+/**
+ * Quit the application on SIGINT and SIGTERM, so that
+ * the node list is saved when running without a window.
+ */
+static void installSignalHandlers(QCoreApplication &app)
+{
+    if(pipe(signalPipe) < 0) {
+        qWarning("Can't create signal pipe");
+        return;
+    }
+
+    auto sn = new QSocketNotifier(signalPipe[0], QSocketNotifier::Read, &app);
+    QObject::connect(sn, &QSocketNotifier::activated, &app, &QCoreApplication::quit);
+
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+}
+
+/**
+ * Check for an option before the application object exists.
+ * Matches "--name" and "--name=value".
+ */
+static bool hasOption(int argc, char *argv[], const char *name)
+{
+    size_t len = strlen(name);
+    for(int i=1; i<argc; i++) {
+        if(strncmp(argv[i], name, len) == 0 and (argv[i][len] == '\0' or argv[i][len] == '='))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Parse the command line options of both modes.
+ */
+static void parseOptions(QCommandLineParser &parser, QCoreApplication &app)
+{
+    parser.setApplicationDescription("BitTorrent DHT explorer");
+    parser.addHelpOption();
+    parser.addVersionOption();
+    parser.addOption(QCommandLineOption("headless", "Run the DHT without a window."));
+    parser.addOption(QCommandLineOption("no-network-thread",
+                "Run the DHT on the GUI thread instead of a separate thread."));
+    parser.addOption(QCommandLineOption("batch",
+                "Search for the hashes in <file> (- for stdin) and write the results "
+                "to stdout. Implies --headless.", "file"));
+    parser.addOption(QCommandLineOption("concurrency",
+                "Number of searches in flight during a batch search, monitoring or a crawl.",
+                "n", "64"));
+    parser.addOption(QCommandLineOption("monitor",
+                "Search the hashes in <file> (- for stdin) again and again, sooner when "
+                "their peers change, and write a line per search to stdout. "
+                "Implies --headless.", "file"));
+    parser.addOption(QCommandLineOption("min-interval",
+                "Shortest refresh interval of a monitored hash in seconds.", "s", "300"));
+    parser.addOption(QCommandLineOption("max-interval",
+                "Longest refresh interval of a monitored hash in seconds.", "s", "21600"));
+    parser.addOption(QCommandLineOption("crawl",
+                "Look up random targets all over the keyspace to discover as many nodes "
+                "as possible and write the discovery rate to stdout. Implies --headless."));
+    parser.addOption(QCommandLineOption("crawl-report",
+                "Seconds between two reports of a crawl.", "s", "10"));
+    parser.addOption(QCommandLineOption("send-rate",
+                "Send at most <n> datagrams per second, overrides the configuration.", "n"));
+    parser.addOption(QCommandLineOption("export",
+                "Append all search results to <file> as they arrive.", "file"));
+    parser.addOption(QCommandLineOption("export-format",
+                "Format of the export, ndjson or binary.", "format", "ndjson"));
+    parser.addOption(QCommandLineOption("port",
+                "UDP port, overrides the configuration.", "port"));
+    parser.addOption(QCommandLineOption("node-id",
+                "Node ID as 40 hex digits, overrides the configuration.", "id"));
+    parser.addOption(QCommandLineOption("workers",
+                "Spread a batch search over <n> worker processes, each with its own "
+                "port and a node ID in its own part of the keyspace.", "n", "1"));
+    parser.addOption(QCommandLineOption("control",
+                "Accept search commands on the Unix domain socket <path> and stream the "
+                "results to the clients.", "path"));
+    parser.addOption(QCommandLineOption("metrics-port",
+                "Serve metrics in the Prometheus format on localhost:<port>.", "port"));
+    parser.addOption(QCommandLineOption("capture",
+                "Record all input of the DHT to <file> for bench-replay.", "file"));
+    parser.addOption(QCommandLineOption("log-level",
+                "Minimum level of log messages: trace, debug, info, warning or error.",
+                "level", "info"));
+    parser.process(app);
+
+    if(not Logger::setLevel(parser.value("log-level"))) {
+        qWarning("Unknown log level");
+    }
+}
+
+/**
+ * Start the capture if one was requested. Must be called before
+ * the engine is initialized.
+ */
+static bool openCapture(QCommandLineParser &parser)
+{
+    if(not parser.isSet("capture"))
+        return true;
+
+    if(capture_open(QFile::encodeName(parser.value("capture")).constData()) < 0) {
+        qCritical() << "Can't create capture" << parser.value("capture");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Apply the options for the engine: port, send rate, node ID and the
+ * export of the results. Must be called before the engine is
+ * initialized. Returns false if an option is invalid.
+ */
+static bool configureEngine(QCommandLineParser &parser, DhtEngine &engine)
+{
+    if(parser.isSet("port")) {
+        engine.setPort(parser.value("port").toInt());
+    }
+    if(parser.isSet("send-rate")) {
+        int rate = parser.value("send-rate").toInt();
+        if(rate <= 0) {
+            qCritical("Invalid send rate");
+            return false;
+        }
+        engine.setSendRate(rate);
+    }
+    if(parser.isSet("node-id")) {
+        NodeId id;
+        if(not Codec::parseId(parser.value("node-id").toLatin1(), id)) {
+            qCritical("Invalid node ID");
+            return false;
+        }
+        engine.setNodeId(id);
+    }
+
+    if(parser.isSet("export")) {
+        auto format = parser.value("export-format");
+        if(format != "ndjson" and format != "binary") {
+            qCritical("Invalid export format");
+            return false;
+        }
+
+        auto exporter = new ResultExporter(format == "binary" ? ResultExporter::Binary
+                                                              : ResultExporter::NdJson, &engine);
+        if(not exporter->open(parser.value("export"))) {
+            return false;
+        }
+        engine.setExporter(exporter);
+    }
+
+    return true;
+}
+
+/**
+ * Open the control socket if one was requested. The server is a child
+ * of the engine and moves to the network thread with it.
+ */
+static bool openControl(QCommandLineParser &parser, DhtEngine &engine)
+{
+    if(not parser.isSet("control"))
+        return true;
+
+    auto control = new ControlServer(&engine, &engine);
+    return control->listen(parser.value("control"));
+}
+
+/**
+ * Distribute a batch search over several worker processes.
+ */
+static int runSupervisor(QCommandLineParser &parser, QCoreApplication &app)
+{
+    int workers = parser.value("workers").toInt();
+    if(not parser.isSet("batch")) {
+        qCritical("--workers requires --batch");
+        return 1;
+    }
+
+    int concurrency = parser.value("concurrency").toInt();
+    if(concurrency <= 0) {
+        qCritical("Invalid concurrency");
+        return 1;
+    }
+
+    int basePort = parser.isSet("port") ? parser.value("port").toInt() : 6881;
+
+    ShardSupervisor supervisor(workers);
+    if(not supervisor.open(parser.value("batch"))) {
+        return 1;
+    }
+
+    if(parser.isSet("export")) {
+        supervisor.setExport(parser.value("export"), parser.value("export-format"));
+    }
+
+    if(parser.isSet("metrics-port")) {
+        supervisor.setMetricsPort(parser.value("metrics-port").toInt());
+    }
+
+    QStringList args;
+    args << "--concurrency" << QString::number(concurrency)
+         << "--log-level" << parser.value("log-level");
+    if(not supervisor.start(args, basePort)) {
+        return 1;
+    }
+
+    QObject::connect(&supervisor, &ShardSupervisor::finished, &app, &QCoreApplication::quit);
+    int rc = app.exec();
+    return rc != 0 ? rc : supervisor.exitCode();
+}
+
+/**
+ * Run only the DHT engine, without any widgets.
+ */
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("dht-explorer");
+    QCoreApplication::setApplicationVersion("0.1");
+
+    QCommandLineParser parser;
+    parseOptions(parser, app);
+
+    installSignalHandlers(app);
+
+    if(parser.value("workers").toInt() > 1) {
+        return runSupervisor(parser, app);
+    }
+
+    if(not openCapture(parser)) {
+        return 1;
+    }
+
+    DhtEngine engine;
+    if(not configureEngine(parser, engine)) {
+        return 1;
+    }
+
+    if(not engine.init()) {
+        return 1;
+    }
+
+    if(parser.isSet("metrics-port")) {
+        auto metrics = new MetricsServer(&engine);
+        if(not metrics->listen(parser.value("metrics-port").toInt())) {
+            return 1;
+        }
+    }
+
+    if(not openControl(parser, engine)) {
+        return 1;
+    }
+
+    BatchSearch *batch = nullptr;
+    if(parser.isSet("batch")) {
+        int concurrency = parser.value("concurrency").toInt();
+        if(concurrency <= 0) {
+            qCritical("Invalid concurrency");
+            return 1;
+        }
+
+        batch = new BatchSearch(&engine, concurrency, &engine);
+        if(not batch->open(parser.value("batch"))) {
+            return 1;
+        }
+
+        QObject::connect(batch, &BatchSearch::finished, &app, &QCoreApplication::quit);
+        batch->start();
+    }
+    else if(parser.isSet("monitor")) {
+        int concurrency = parser.value("concurrency").toInt();
+        if(concurrency <= 0) {
+            qCritical("Invalid concurrency");
+            return 1;
+        }
+
+        int minInterval = parser.value("min-interval").toInt();
+        int maxInterval = parser.value("max-interval").toInt();
+        if(minInterval <= 0 or maxInterval < minInterval) {
+            qCritical("Invalid refresh intervals");
+            return 1;
+        }
+
+        auto monitor = new SwarmMonitor(&engine, concurrency, &engine);
+        monitor->setIntervals(minInterval, maxInterval);
+        if(not monitor->open(parser.value("monitor"))) {
+            return 1;
+        }
+        monitor->start();
+    }
+    else if(parser.isSet("crawl")) {
+        int concurrency = parser.value("concurrency").toInt();
+        if(concurrency <= 0) {
+            qCritical("Invalid concurrency");
+            return 1;
+        }
+
+        int interval = parser.value("crawl-report").toInt();
+        if(interval <= 0) {
+            qCritical("Invalid report interval");
+            return 1;
+        }
+
+        auto crawler = new Crawler(&engine, concurrency, &engine);
+        if(not crawler->open(interval)) {
+            return 1;
+        }
+        crawler->start();
+    }
+
+    return app.exec();
+}
+
+/**
+ * Run the GUI
+ */
+static int runGui(int argc, char *argv[])
 {
     QApplication app(argc, argv);
     QCoreApplication::setApplicationName("dht-explorer");
     QCoreApplication::setApplicationVersion("0.1");
 
-    srand(time(nullptr));
+    QCommandLineParser parser;
+    parseOptions(parser, app);
+
+    if(not openCapture(parser)) {
+        return 1;
+    }
 
     MainWindow window;
-    if(not window.init()) {
+    if(not configureEngine(parser, *window.getEngine()) or
+       not openControl(parser, *window.getEngine())) {
+        return 1;
+    }
+
+    if(not window.init(not parser.isSet("no-network-thread"))) {
+        return 1;
+    }
+
+    MetricsServer metrics;
+    if(parser.isSet("metrics-port") and not metrics.listen(parser.value("metrics-port").toInt())) {
         return 1;
     }
 
     return app.exec();
 }
+
+int main(int argc, char *argv[])
+{
+    srand(time(nullptr));
+    Logger::start();
+
+    int rc;
+    if(hasOption(argc, argv, "--headless") or hasOption(argc, argv, "--batch")
+       or hasOption(argc, argv, "--monitor") or hasOption(argc, argv, "--crawl")) {
+        rc = runHeadless(argc, argv);
+    }
+    else {
+        rc = runGui(argc, argv);
+    }
+
+    /* The engine is gone, nothing calls into dht.c anymore */
+    if(capture_close() < 0) {
+        qWarning("Writing the capture failed, it is incomplete");
+    }
+
+    Logger::stop();
+    return rc;
+}
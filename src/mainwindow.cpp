@@ -15,35 +15,27 @@
  * along with this program. If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <sys/socket.h>
-#include <sys/types.h>
-#include <arpa/inet.h>
-#include <unistd.h>
-#include <cstdlib>
-
 #include <QDebug>
-#include <QDir>
 #include <QByteArray>
-#include <QHostAddress>
-#include <QUrl>
 #include <QClipboard>
 #include "mainwindow.h"
-#include "dht/dht.h"
+#include "codec.h"
 
 #include "ui_mainwindow.h"
 
 
 MainWindow::MainWindow() :
     ui(new Ui::MainWindow),
-    s4(-1),
-    s6(-1),
-    sn4(nullptr),
-    sn6(nullptr),
-    settings(nullptr),
-    myID(nullptr)
+    engine(new DhtEngine),
+    engineThread(nullptr),
+    events(new EngineEventQueue)
 {
     ui->setupUi(this);
     ui->peerList->setSelectionMode(QAbstractItemView::ExtendedSelection);
+    ui->peerList->setUniformItemSizes(true);
+
+    peerModel = new PeerListModel(this);
+    ui->peerList->setModel(peerModel);
 
     searchValidator = new HashValidator(this);
     ui->searchInput->setValidator(searchValidator);
@@ -68,172 +60,53 @@ MainWindow::MainWindow() :
     trayIcon->show();
 
     connect(trayIcon, &QSystemTrayIcon::activated, this, &MainWindow::iconActivated);
+
+    engine->setEventQueue(events);
+    connect(engine, &DhtEngine::eventsAvailable, this, &MainWindow::drainEngineEvents);
 }
 
 MainWindow::~MainWindow()
 {
-    auto peers = getPeers();
-    settings->setValue("nodes", peers);
-    settings->sync();
-
-    dht_uninit();
-
-    if(s4 >= 0)
-        ::close(s4);
-
-    if(s6 >= 0)
-        ::close(s6);
-
-    delete sn4;
-    delete sn6;
-    delete timer;
+    /* The engine is deleted on its own thread when the thread finishes */
+    if(engineThread) {
+        engineThread->quit();
+        engineThread->wait();
+    }
+    else {
+        delete engine;
+    }
 
-    settings->sync();
-    delete settings;
-    delete[] myID;
+    delete events;
+    delete ui;
 }
 
 /**
  * Initialize the DHT. Returns true on success.
+ * If threaded is set, the DHT runs on a separate network thread.
  */
-bool MainWindow::init()
+bool MainWindow::init(bool threaded)
 {
-    /* Get the configuration */
-    auto cfgfile = QString("%1/.config/dht-explorer/default.conf").arg(QDir::homePath());
-    settings = new QSettings(cfgfile, QSettings::IniFormat, this);
-
-    auto port = settings->value("port", "6881").toInt();
-    auto useIPv4 = settings->value("IPv4", "1").toInt();
-    auto useIPv6 = settings->value("IPv6", "0").toInt();
-    auto id = settings->value("ID", "").toString();
-    auto btNodes = settings->value("nodes", QStringList() << "82.221.103.244:6881").toStringList();
-
-    /* Create a new ID if it doesn't exist */
-    myID = new unsigned char[20];
-    if(id.size() != 40) {
-        /* Generate new ID */
-        for(int i=0; i<20; i++)
-            myID[i] = rand() % 256;
-        settings->setValue("ID", QString(QByteArray((char *) myID, 20).toHex()));
-    }
-    else {
-        memcpy(&myID[0], QByteArray::fromHex(id.toLatin1()).data(), 20);
-    }
-    qDebug() << "Using ID" << id;
-    settings->sync();
-
-    /* Initialize the sockets and the DHT */
-    int rc;
+    bool ok = false;
 
-    sockaddr_in  sin4;
-    sockaddr_in6 sin6;
+    if(threaded) {
+        engineThread = new QThread(this);
+        engine->moveToThread(engineThread);
+        connect(engineThread, &QThread::finished, engine, &QObject::deleteLater);
+        engineThread->start();
 
-    memset(&sin4, 0, sizeof(sin4));
-    sin4.sin_family = AF_INET;
-
-    memset(&sin6, 0, sizeof(sin6));
-    sin6.sin6_family = AF_INET6;
-
-    if(useIPv4) {
-        s4 = socket(AF_INET, SOCK_DGRAM, 0);
-        if(s4 < 0) {
-            qCritical("Creation of IPv4 socket failed");
-            return false;
-        }
-
-        /* Setup the IPv4 socket */
-        sin4.sin_port = htons(port);
-        rc = bind(s4, (sockaddr*) &sin4, sizeof(sin4));
-        if(rc < 0) {
-            qCritical("Binding of IPv4 socket failed");
-            return false;
-        }
+        QMetaObject::invokeMethod(engine, "init", Qt::BlockingQueuedConnection,
+                                  Q_RETURN_ARG(bool, ok));
     }
-
-    if(useIPv6) {
-        s6 = socket(AF_INET6, SOCK_DGRAM, 0);
-        if(s6 < 0) {
-            qCritical("Creation of IPv6 socket failed");
-            return false;
-        }
-
-        /* Setup the IPv6 socket */
-        int val = 1;
-        rc = setsockopt(s6, IPPROTO_IPV6, IPV6_V6ONLY, (char *) &val, sizeof(val));
-        if(rc < 0) {
-            qCritical("setsockopt() on IPv6 socket failed");
-            return false;
-        }
-
-        sin6.sin6_port = htons(port);
-        rc = bind(s6, (sockaddr*)&sin6, sizeof(sin6));
-        if(rc < 0) {
-            qCritical("bind() on IPv6 socket failed");
-            return false;
-        }
-    }
-
-    /* Setup the DHT. This sets the sockets to non-blocking. */
-    rc = dht_init(s4, s6, myID, (unsigned char *)"AFG\0");
-    if(rc < 0) {
-        qCritical("dht_init() failed");
-        return false;
-    }
-
-    /* Bootstrap the DHT */
-    for(auto &s : btNodes) {
-        /* QUrl requires a scheme */
-        QUrl url(QString("http://%1").arg(s));
-
-        if(not url.isValid())
-            continue;
-
-        auto ip = url.host();
-        auto port = url.port();
-
-        if(QHostAddress(ip).protocol() == QAbstractSocket::IPv4Protocol) {
-            sockaddr_in sin;
-            memset(&sin, 0, sizeof(sockaddr_in));
-            sin.sin_family = AF_INET;
-            rc = inet_pton(AF_INET, ip.toLatin1().data(), &sin.sin_addr);
-            if(rc == 1) {
-                sin.sin_port = htons(port);
-                socklen_t salen = sizeof(sockaddr_in);
-                rc = dht_ping_node((sockaddr*) &sin, salen);
-
-                if(rc > 0) {
-                    qDebug() << "Bootstrapped from" << s;
-                }
-                else {
-                    qDebug() << "Bootstrapping from" << s << "failed";
-                }
-            }
-        }
-        else if(QHostAddress(ip).protocol() == QAbstractSocket::IPv6Protocol) {
-            qDebug() << "Bootstrapping from IPv6 not implemented";
-        }
-    }
-
-    /* At this point, the DHT should be initialized. We can now set up
-     * the QSocketNotifiers and process the remaining events through
-     * the event loop.
-     */
-    if(useIPv4) {
-        sn4 = new QSocketNotifier(s4, QSocketNotifier::Read, this);
-        connect(sn4, &QSocketNotifier::activated, this, &MainWindow::socketActivated);
-    }
-
-    if(useIPv6) {
-        sn6 = new QSocketNotifier(s6, QSocketNotifier::Read, this);
-        connect(sn6, &QSocketNotifier::activated, this, &MainWindow::socketActivated);
+    else {
+        ok = engine->init();
     }
 
-    timer = new QTimer(this);
-    timer->setSingleShot(true);
-    connect(timer, &QTimer::timeout, this, &MainWindow::timerActivated);
-    timer->start(0);
+    return ok;
+}
 
-    return true;
+DhtEngine *MainWindow::getEngine(void)
+{
+    return engine;
 }
 
 /**
@@ -263,202 +136,85 @@ void MainWindow::on_actionQuit_triggered()
 }
 
 /**
- * Activity on a socket. This is triggered by the socket nofiiers.
+ * Update peerlist and systray icon
  */
-void MainWindow::socketActivated(int s)
+void MainWindow::updatePeers(const EngineEvent &event)
 {
-    if(s == s4)
-        qDebug() << "IPv4 socket activated";
-    else if(s == s6)
-        qDebug() << "IPv6 socket activated";
-
-    timer->stop();
-
-    /* Receive and process datagrams */
-    int rc;
-    char buffer[4096];
-    sockaddr_storage from;
-    socklen_t fromlen = sizeof(from);
-    time_t tosleep;
-
-    rc = recvfrom(s, buffer, sizeof(buffer) - 1, 0, (sockaddr *) &from, &fromlen);
-    if(rc > 0) {
-        buffer[rc] = '\0';
-        rc = dht_periodic(buffer, rc, (sockaddr*)&from, fromlen,
-                          &tosleep, this->dhtCallback, this);
-    }
-    else {
-        rc = dht_periodic(nullptr, 0, nullptr, 0, &tosleep, this->dhtCallback, this);
-    }
-
-    if(rc < 0) {
-        tosleep = 1;
-    }
+    trayIcon->setToolTip(QString("Peers: %1+%2").arg(event.good4).arg(event.good6));
+    peerLabel->setText(QString("Peers: %1+%2").arg(event.good4).arg(event.good6));
+    peerLabel->setToolTip(QString("Datagrams dropped: %1").arg(event.drops));
 
-    timer->start(tosleep * 1000);
-
-    updatePeers();
+    peerModel->applyChanges(event.added, event.removed);
 }
 
 /**
- * Timeout triggered.
+ * Hash of an entry in the searchList widget
  */
-void MainWindow::timerActivated(void)
+static QByteArray itemHash(const QListWidgetItem *item)
 {
-    qDebug() << "Timer activated";
-
-    int rc;
-    time_t tosleep = 0;
-
-    rc = dht_periodic(nullptr, 0, nullptr, 0, &tosleep, this->dhtCallback, this);
-    timer->start(tosleep * 1000);
-
-    updatePeers();
+    NodeId id;
+    if(not Codec::parseId(item->text().toLatin1(), id))
+        return QByteArray();
+    return QByteArray((const char *) id.data, NodeId::size);
 }
 
 /**
- * Called by dht_periodic.
- * inst is a pointer to a CallbackInfo structure.
+ * Process all events queued by the engine. Only peers that are new to
+ * the selected search are appended to the results widget, the full list
+ * is rebuilt when the selection changes.
  */
-void MainWindow::dhtCallback(void *win, int event,
-                             const unsigned char *info_hash,
-                             const void *data, size_t data_len)
+void MainWindow::drainEngineEvents(void)
 {
-    auto window = static_cast<MainWindow *>(win);
-    QByteArray hash((char *) info_hash, 20);
-
-    /* Find the SearchInfo structure for the callback */
-    SearchInfo *info = window->findSearchInfo(hash);
-
-    if(info) {
-        if(event == DHT_EVENT_SEARCH_DONE) {
-            qDebug() << "Search for" << hash.toHex() << "completed";
-            emit info->searchDone();
-        }
-        else if(event == DHT_EVENT_VALUES) {
-            qDebug() << "Received" << data_len / 6 << "values for" << hash.toHex();
-
-            for(int i=0; i<data_len; i+=6) {
-                int port = (((const unsigned char *) data)[i+4] << 8) | ((const unsigned char *) data)[i+5];
+    engine->acknowledgeEvents();
 
-                auto addr = QString("%1.%2.%3.%4:%5")
-                    .arg(((unsigned char *) data)[i+0])
-                    .arg(((unsigned char *) data)[i+1])
-                    .arg(((unsigned char *) data)[i+2])
-                    .arg(((unsigned char *) data)[i+3])
-                    .arg(port);
-
-                info->results.insert(addr);
+    auto item = ui->searchList->currentItem();
+    QByteArray current = item ? itemHash(item) : QByteArray();
+    QStringList added;
+
+    EngineEvent event;
+    while(events->pop(event)) {
+        if(event.type == EngineEvent::SearchValues) {
+            auto it = searchResults.find(event.hash);
+            if(it != searchResults.end()) {
+                bool selected = event.hash == current;
+                for(auto &p : event.peers) {
+                    if(it->insert(p) and selected)
+                        added.append(Codec::endpointToString(p));
+                }
             }
-            emit info->searchUpdate();
         }
-        else if(event == DHT_EVENT_VALUES6) {
-            qDebug() << "Receiving IPv6 nodes not supported";
+        else if(event.type == EngineEvent::NodesChanged) {
+            updatePeers(event);
         }
     }
-    else {
-        qDebug() << "Callback executed for unknown hash" << hash.toHex();
-    }
-}
-
-/**
- * Update peerlist and systray icon
- */
-void MainWindow::updatePeers(void)
-{
-    int good4, good6;
-
-    dht_nodes(AF_INET, &good4, nullptr, nullptr, nullptr);
-    dht_nodes(AF_INET6, &good6, nullptr, nullptr, nullptr);
 
-    trayIcon->setToolTip(QString("Peers: %1+%2").arg(good4).arg(good6));
-    peerLabel->setText(QString("Peers: %1+%2").arg(good4).arg(good6));
-
-    auto peers = getPeers();
-    peers.sort();
-
-    ui->peerList->clear();
-    for(auto &p : peers) {
-        ui->peerList->addItem(p);
+    if(not added.isEmpty()) {
+        ui->searchResults->addItems(added);
+        ui->searchLabel->setText(QString("%1 nodes").arg(searchResults.constFind(current)->size()));
     }
 }
 
-/**
- * Return a list of all active peers
- */
-QStringList MainWindow::getPeers(void)
-{
-    int num4 = 1024;
-    sockaddr_in sin4[num4];
-
-    int num6 = 1024;
-    sockaddr_in6 sin6[num6];
-
-    dht_get_nodes(&sin4[0], &num4, &sin6[0], &num6);
-
-    QStringList nodes;
-    char buffer[128];
-    for(int i=0; i<num4; i++) {
-        inet_ntop(AF_INET, &sin4[i].sin_addr, buffer, 128);
-        nodes.append(QString("%1:%2").arg(buffer).arg(ntohs(sin4[i].sin_port)));
-    }
-    for(int i=0; i<num6; i++) {
-        inet_ntop(AF_INET6, &sin6[i].sin6_addr, buffer, 128);
-        nodes.append(QString("[%1]:%2").arg(buffer).arg(ntohs(sin4[i].sin_port)));
-    }
-
-    return nodes;
-}
-
 /**
  * Start a new search
  */
 void MainWindow::searchButtonClicked(bool unused)
 {
-    auto hash = QByteArray::fromHex(ui->searchInput->text().toLatin1());
-    SearchInfo *info = findSearchInfo(hash);
+    NodeId id;
+    if(not Codec::parseId(ui->searchInput->text().toLatin1(), id))
+        return;
+    QByteArray hash((const char *) id.data, NodeId::size);
 
-    bool exists = true;
-    if(not info) {
-        info = new SearchInfo(hash, this);
-        exists = false;
-    }
-
-    if(exists) {
-        qDebug() << "Restart search for" << info->hash.toHex();
-    }
-    else {
-        qDebug() << "Start a search for" << info->hash.toHex();
+    if(not searchResults.contains(hash)) {
+        searchResults.insert(hash, EndpointSet());
 
-        ui->searchList->addItem(info->hash.toHex());
+        ui->searchList->addItem(Codec::idToString(id));
         if(ui->searchList->count() == 1) {
             ui->searchList->setCurrentRow(0);
         }
-        ui->searchInput->clear();
-
-        activeSearches.append(info);
-        connect(info, &SearchInfo::searchDone, this, &MainWindow::searchDone);
-        connect(info, &SearchInfo::searchUpdate, this, &MainWindow::searchUpdate);
     }
     ui->searchInput->clear();
 
-    dht_search((unsigned char *) info->hash.data(), 0, AF_INET, &MainWindow::dhtCallback, this);
-}
-
-/**
- * Called when a search is completed
- */
-void MainWindow::searchDone(void)
-{
-    updateSearchResults();
-}
-
-/**
- * Called when a search is updated
- */
-void MainWindow::searchUpdate(void)
-{
-    updateSearchResults();
+    QMetaObject::invokeMethod(engine, "search", Qt::QueuedConnection, Q_ARG(QByteArray, hash));
 }
 
 /**
@@ -477,15 +233,15 @@ void MainWindow::updateSearchResults(void)
 {
     auto item = ui->searchList->currentItem();
     if(item) {
-        QByteArray hash = QByteArray::fromHex(item->text().toLatin1());
-        SearchInfo *info = findSearchInfo(hash);
+        QByteArray hash = itemHash(item);
+        auto it = searchResults.constFind(hash);
 
-        if(info) {
+        if(it != searchResults.constEnd()) {
             ui->searchResults->clear();
-            for(auto &r : info->results) {
-                ui->searchResults->addItem(r);
-            }
-            ui->searchLabel->setText(QString("%1 nodes").arg(info->results.count()));
+            it->forEach([this](const Endpoint &e) {
+                ui->searchResults->addItem(Codec::endpointToString(e));
+            });
+            ui->searchLabel->setText(QString("%1 nodes").arg(it->size()));
         }
     }
 }
@@ -497,13 +253,17 @@ void MainWindow::copyResultsToClipboard(void)
 {
     auto item = ui->searchList->currentItem();
     if(item) {
-        QByteArray hash = QByteArray::fromHex(item->text().toLatin1());
-        SearchInfo *info = findSearchInfo(hash);
+        QByteArray hash = itemHash(item);
+        auto it = searchResults.constFind(hash);
+
+        if(it != searchResults.constEnd()) {
+            QStringList results;
+            it->forEach([&results](const Endpoint &e) {
+                results.append(Codec::endpointToString(e));
+            });
 
-        if(info) {
-            QString results = QStringList(info->results.toList()).join("\n");
             QClipboard *clipboard = QApplication::clipboard();
-            clipboard->setText(results);
+            clipboard->setText(results.join("\n"));
         }
     }
 }
@@ -515,12 +275,10 @@ void MainWindow::refreshButtonClicked(bool unused)
 {
     auto item = ui->searchList->currentItem();
     if(item) {
-        QByteArray hash = QByteArray::fromHex(item->text().toLatin1());
-        SearchInfo *info = findSearchInfo(hash);
+        QByteArray hash = itemHash(item);
 
-        if(info) {
-            qDebug() << "Restarting search for" << hash.toHex();
-            dht_search((unsigned char *) info->hash.data(), 0, AF_INET, &MainWindow::dhtCallback, this);
+        if(searchResults.contains(hash)) {
+            QMetaObject::invokeMethod(engine, "search", Qt::QueuedConnection, Q_ARG(QByteArray, hash));
         }
     }
 }
@@ -532,11 +290,10 @@ void MainWindow::clearButtonClicked(bool unused)
 {
     auto item = ui->searchList->currentItem();
     if(item) {
-        QByteArray hash = QByteArray::fromHex(item->text().toLatin1());
-        SearchInfo *info = findSearchInfo(hash);
+        QByteArray hash = itemHash(item);
 
-        if(info) {
-            activeSearches.removeAll(info);
+        if(searchResults.remove(hash)) {
+            QMetaObject::invokeMethod(engine, "removeSearch", Qt::QueuedConnection, Q_ARG(QByteArray, hash));
             delete ui->searchList->currentItem();
 
             if(ui->searchList->count() == 0) {
@@ -546,17 +303,3 @@ void MainWindow::clearButtonClicked(bool unused)
         }
     }
 }
-
-/**
- * Find the SearchInfo structure belonging to a hash
- */
-SearchInfo * MainWindow::findSearchInfo(QByteArray &hash)
-{
-    SearchInfo *info = nullptr;
-    for(auto &p : activeSearches) {
-        if(p->hash == hash) {
-            return p;
-        }
-    }
-    return nullptr;
-}
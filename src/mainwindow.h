@@ -19,35 +19,17 @@
 
 #include <QMainWindow>
 #include <QSystemTrayIcon>
-#include <QSocketNotifier>
-#include <QSettings>
-#include <QTimer>
-#include <QSet>
 #include <QLabel>
 #include <QListWidgetItem>
+#include <QThread>
+#include <QHash>
 
 #include "hashvalidator.h"
+#include "dhtengine.h"
+#include "endpointset.h"
+#include "peerlistmodel.h"
 
 
-class SearchInfo : public QObject
-{
-    Q_OBJECT
-
-public:
-    explicit SearchInfo(QByteArray &hash, QObject *parent = 0) :
-        QObject(parent),
-        hash(hash)
-    { }
-
-signals:
-    void searchDone();
-    void searchUpdate();
-
-public:
-    QByteArray hash;            /* Hash that is being searched */
-    QSet<QString> results;      /* Adresses discovered */
-};
-
 namespace Ui {
     class MainWindow;
 }
@@ -59,44 +41,33 @@ class MainWindow : public QMainWindow
 public:
     MainWindow();
     ~MainWindow();
-    bool init();
+    bool init(bool threaded = true);
+    DhtEngine *getEngine(void);     /* Options must be set before init() */
 
 private slots:
     void on_actionHide_triggered();
     void on_actionQuit_triggered();
     void iconActivated(QSystemTrayIcon::ActivationReason reason);
-    void socketActivated(int s);
-    void timerActivated(void);
     void searchButtonClicked(bool unused);
     void refreshButtonClicked(bool unused);
     void clearButtonClicked(bool unused);
-    void searchDone(void);
-    void searchUpdate(void);
     void searchListRowChanged(int row);
     void copyResultsToClipboard(void);
+    void drainEngineEvents(void);   /* Process events from the engine */
 
 private:
-    static void dhtCallback(void *win, int event, const unsigned char *info_hash,
-                  const void *data, size_t data_len);
-
-    void updatePeers(void);         /* Update peerlist widget */
-    QStringList getPeers(void);     /* Get the list of peers */
+    void updatePeers(const EngineEvent &event);  /* Update peerlist and systray icon */
     void updateSearchResults(void); /* Update the search results widget */
-    SearchInfo *findSearchInfo(QByteArray &hash);
 
     Ui::MainWindow *ui;
     QMenu *trayIconMenu;
     QSystemTrayIcon *trayIcon;
     HashValidator *searchValidator;
     QLabel *peerLabel;
+    PeerListModel *peerModel;
 
-    int s4;                 /* Descriptor for IPv4 socket */
-    int s6;                 /* Descriptor for IPv6 socket */
-    QSocketNotifier *sn4;   /* Socket notifier for IPv4 socket */
-    QSocketNotifier *sn6;   /* Socket notifier for IPv6 socket */
-    QTimer *timer;          /* Timer to call dht_periodic */
-
-    QList<SearchInfo *> activeSearches;
-    QSettings *settings;
-    unsigned char *myID;
+    DhtEngine *engine;
+    QThread *engineThread;          /* Network thread, null if the engine runs on the GUI thread */
+    EngineEventQueue *events;       /* Events from the engine */
+    QHash<QByteArray, EndpointSet> searchResults;
 };
@@ -0,0 +1,167 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cstring>
+
+#include "metrics.h"
+
+
+QMutex Metrics::lock;
+QVector<Metrics::Shard *> Metrics::shards;
+std::atomic<qint64> Metrics::gauges[Metrics::NumGauges];
+
+
+Metrics::Shard::Shard() :
+    sum(0)
+{
+    for(auto &c : counters)
+        c.store(0, std::memory_order_relaxed);
+    for(auto &b : buckets)
+        b.store(0, std::memory_order_relaxed);
+}
+
+Metrics::Shard *Metrics::registerShard(void)
+{
+    auto s = new Shard;
+    QMutexLocker locker(&lock);
+    shards.append(s);
+    return s;
+}
+
+void Metrics::observePeriodic(quint64 ns)
+{
+    quint64 us = ns / 1000;
+    int i = 0;
+    while(i < numBuckets and us >= (quint64(1) << i))
+        i++;
+
+    Shard *s = shard();
+    s->buckets[i].store(s->buckets[i].load(std::memory_order_relaxed) + 1,
+                        std::memory_order_relaxed);
+    s->sum.store(s->sum.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+}
+
+/* Name and labels of every counter */
+static const struct {
+    const char *name;
+    const char *labels;
+} counterNames[Metrics::NumCounters] = {
+    { "dht_datagrams_received_total", "family=\"ipv4\"" },
+    { "dht_datagrams_received_total", "family=\"ipv6\"" },
+    { "dht_bytes_received_total", "family=\"ipv4\"" },
+    { "dht_bytes_received_total", "family=\"ipv6\"" },
+    { "dht_datagrams_sent_total", "family=\"ipv4\"" },
+    { "dht_datagrams_sent_total", "family=\"ipv6\"" },
+    { "dht_bytes_sent_total", "family=\"ipv4\"" },
+    { "dht_bytes_sent_total", "family=\"ipv6\"" },
+    { "dht_wakeups_total", "source=\"socket\"" },
+    { "dht_wakeups_total", "source=\"timer\"" },
+    { "dht_callbacks_total", "event=\"values\"" },
+    { "dht_callbacks_total", "event=\"values6\"" },
+    { "dht_callbacks_total", "event=\"search_done\"" },
+    { "dht_callbacks_total", "event=\"search_done6\"" },
+    { "dht_admission_dropped_total", "reason=\"blocklist\"" },
+    { "dht_admission_dropped_total", "reason=\"rate_limit\"" },
+    { "dht_syscalls_total", "call=\"recvmmsg\"" },
+    { "dht_syscalls_total", "call=\"epoll_wait\"" },
+    { "dht_syscalls_total", "call=\"timerfd_settime\"" },
+    { "dht_syscalls_total", "call=\"sendmmsg\"" },
+    { "dht_send_retries_total", "" },
+    { "dht_send_dropped_total", "reason=\"queue_full\"" },
+    { "dht_send_dropped_total", "reason=\"error\"" },
+};
+
+static const struct {
+    const char *name;
+    const char *labels;
+} gaugeNames[Metrics::NumGauges] = {
+    { "dht_active_searches", "" },
+    { "dht_nodes", "family=\"ipv4\",state=\"good\"" },
+    { "dht_nodes", "family=\"ipv6\",state=\"good\"" },
+    { "dht_nodes", "family=\"ipv4\",state=\"dubious\"" },
+    { "dht_nodes", "family=\"ipv6\",state=\"dubious\"" },
+    { "dht_receive_drops", "" },
+    { "dht_send_queue_depth", "" },
+    { "dht_unique_peers", "" },
+    { "dht_peer_table_bytes", "" },
+};
+
+static void appendSample(QByteArray &out, const char *name, const char *labels, const QByteArray &value)
+{
+    out.append(name);
+    if(*labels) {
+        out.append('{');
+        out.append(labels);
+        out.append('}');
+    }
+    out.append(' ');
+    out.append(value);
+    out.append('\n');
+}
+
+QByteArray Metrics::format(void)
+{
+    quint64 counters[NumCounters] = {};
+    quint64 buckets[numBuckets + 1] = {};
+    quint64 sum = 0;
+
+    {
+        QMutexLocker locker(&lock);
+        for(auto s : shards) {
+            for(int i=0; i<NumCounters; i++)
+                counters[i] += s->counters[i].load(std::memory_order_relaxed);
+            for(int i=0; i<=numBuckets; i++)
+                buckets[i] += s->buckets[i].load(std::memory_order_relaxed);
+            sum += s->sum.load(std::memory_order_relaxed);
+        }
+    }
+
+    QByteArray out;
+    const char *last = "";
+    for(int i=0; i<NumCounters; i++) {
+        if(strcmp(last, counterNames[i].name) != 0) {
+            last = counterNames[i].name;
+            out.append("# TYPE ").append(last).append(" counter\n");
+        }
+        appendSample(out, counterNames[i].name, counterNames[i].labels,
+                     QByteArray::number(counters[i]));
+    }
+
+    for(int i=0; i<NumGauges; i++) {
+        if(strcmp(last, gaugeNames[i].name) != 0) {
+            last = gaugeNames[i].name;
+            out.append("# TYPE ").append(last).append(" gauge\n");
+        }
+        appendSample(out, gaugeNames[i].name, gaugeNames[i].labels,
+                     QByteArray::number(gauges[i].load(std::memory_order_relaxed)));
+    }
+
+    out.append("# TYPE dht_periodic_duration_seconds histogram\n");
+    quint64 count = 0;
+    for(int i=0; i<numBuckets; i++) {
+        count += buckets[i];
+        QByteArray le = "le=\"" + QByteArray::number((quint64(1) << i) / 1e6, 'g', 6) + "\"";
+        appendSample(out, "dht_periodic_duration_seconds_bucket", le.constData(),
+                     QByteArray::number(count));
+    }
+    count += buckets[numBuckets];
+    appendSample(out, "dht_periodic_duration_seconds_bucket", "le=\"+Inf\"", QByteArray::number(count));
+    appendSample(out, "dht_periodic_duration_seconds_sum", "", QByteArray::number(sum / 1e9, 'f', 6));
+    appendSample(out, "dht_periodic_duration_seconds_count", "", QByteArray::number(count));
+
+    return out;
+}
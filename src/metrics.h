@@ -0,0 +1,131 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QByteArray>
+#include <QMutex>
+#include <QVector>
+#include <atomic>
+#include <ctime>
+
+
+/**
+ * Process wide counters, gauges and a latency histogram.
+ *
+ * Every thread updates its own shard with relaxed stores, so recording
+ * never takes a lock and never contends with other threads. A shard is
+ * registered under a mutex the first time a thread records something.
+ * format() adds up the shards when the metrics are scraped.
+ */
+class Metrics
+{
+public:
+    enum Counter {
+        DatagramsIn4,
+        DatagramsIn6,
+        BytesIn4,
+        BytesIn6,
+        DatagramsOut4,
+        DatagramsOut6,
+        BytesOut4,
+        BytesOut6,
+        SocketWakeups,
+        TimerWakeups,
+        EventValues,
+        EventValues6,
+        EventSearchDone,
+        EventSearchDone6,
+        DroppedBlocked,
+        DroppedRateLimited,
+        ReceiveCalls,
+        ReactorWaits,
+        TimerArms,
+        SendCalls,
+        SendRetries,
+        SendDropped,
+        SendErrors,
+        NumCounters
+    };
+
+    enum Gauge {
+        ActiveSearches,
+        GoodNodes4,
+        GoodNodes6,
+        DubiousNodes4,
+        DubiousNodes6,
+        ReceiveDrops,
+        SendQueueDepth,
+        UniquePeers,
+        PeerTableBytes,
+        NumGauges
+    };
+
+    /* Histogram bucket i counts durations below 2^i microseconds */
+    static const int numBuckets = 22;
+
+    static void add(Counter c, quint64 n = 1)
+    {
+        Shard *s = shard();
+        s->counters[c].store(s->counters[c].load(std::memory_order_relaxed) + n,
+                             std::memory_order_relaxed);
+    }
+
+    /* Gauges have a single writer, the engine thread */
+    static void set(Gauge g, qint64 value)
+    {
+        gauges[g].store(value, std::memory_order_relaxed);
+    }
+
+    /* Record the duration of a dht_periodic() call in nanoseconds */
+    static void observePeriodic(quint64 ns);
+
+    /* Monotonic clock in nanoseconds */
+    static quint64 now(void)
+    {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return quint64(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    /* Prometheus text exposition format */
+    static QByteArray format(void);
+
+private:
+    struct Shard
+    {
+        Shard();
+
+        std::atomic<quint64> counters[NumCounters];
+        std::atomic<quint64> buckets[numBuckets + 1];   /* Last bucket is +Inf */
+        std::atomic<quint64> sum;                       /* Nanoseconds */
+    };
+
+    static Shard *shard(void)
+    {
+        static thread_local Shard *local = nullptr;
+        if(not local)
+            local = registerShard();
+        return local;
+    }
+
+    static Shard *registerShard(void);
+
+    static QMutex lock;                 /* Protects the list of shards */
+    static QVector<Shard *> shards;     /* Never freed, threads are long-lived */
+    static std::atomic<qint64> gauges[NumGauges];
+};
@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QHostAddress>
+
+#include "metricsserver.h"
+#include "metrics.h"
+
+
+/* Requests with larger headers are dropped */
+static const int maxRequestSize = 8192;
+
+
+MetricsServer::MetricsServer(QObject *parent) :
+    QObject(parent),
+    server(new QTcpServer(this))
+{
+    connect(server, &QTcpServer::newConnection, this, &MetricsServer::newConnection);
+}
+
+/**
+ * Listen on localhost. Returns true on success.
+ */
+bool MetricsServer::listen(quint16 port)
+{
+    if(not server->listen(QHostAddress::LocalHost, port)) {
+        qCritical() << "Can't listen on metrics port" << port << server->errorString();
+        return false;
+    }
+    qInfo() << "Serving metrics on http://127.0.0.1:" << port << "/metrics";
+    return true;
+}
+
+void MetricsServer::newConnection(void)
+{
+    while(server->hasPendingConnections()) {
+        QTcpSocket *socket = server->nextPendingConnection();
+        connect(socket, &QTcpSocket::readyRead, this, &MetricsServer::readRequest);
+        connect(socket, &QTcpSocket::disconnected, socket, &QObject::deleteLater);
+    }
+}
+
+/**
+ * Answer as soon as the request header is complete
+ */
+void MetricsServer::readRequest(void)
+{
+    auto socket = qobject_cast<QTcpSocket *>(sender());
+    if(not socket)
+        return;
+
+    if(socket->bytesAvailable() > maxRequestSize) {
+        socket->abort();
+        return;
+    }
+
+    QByteArray request = socket->peek(socket->bytesAvailable());
+    if(not request.contains("\r\n\r\n") and not request.contains("\n\n"))
+        return;
+
+    disconnect(socket, &QTcpSocket::readyRead, this, &MetricsServer::readRequest);
+
+    QByteArray body = Metrics::format();
+    QByteArray response = "HTTP/1.0 200 OK\r\n"
+                          "Content-Type: text/plain; version=0.0.4\r\n"
+                          "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                          "Connection: close\r\n"
+                          "\r\n";
+    socket->write(response);
+    socket->write(body);
+    socket->disconnectFromHost();
+}
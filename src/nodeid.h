@@ -0,0 +1,69 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <cstddef>
+
+
+/**
+ * 160 bit identifier of a node or an info hash
+ */
+struct NodeId
+{
+    static const int size = 20;
+
+    unsigned char data[size];
+
+    static NodeId fromBytes(const void *bytes)
+    {
+        NodeId id;
+        memcpy(id.data, bytes, size);
+        return id;
+    }
+
+    /**
+     * Hash value for tables. Ids are SHA-1 digests or random,
+     * so a few mixed bytes are distributed well enough.
+     */
+    size_t hash() const
+    {
+        uint64_t h;
+        memcpy(&h, data, sizeof(h));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    bool operator==(const NodeId &other) const
+    {
+        return memcmp(data, other.data, size) == 0;
+    }
+
+    bool operator!=(const NodeId &other) const
+    {
+        return not (*this == other);
+    }
+
+    bool operator<(const NodeId &other) const
+    {
+        return memcmp(data, other.data, size) < 0;
+    }
+};
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "endpoint.h"
+#include "endpointset.h"
+
+
+/**
+ * Set of node addresses for crawls with millions of nodes. IPv4 nodes
+ * are packed into one 64 bit word each, address and port, so a node
+ * takes 8 bytes of table space at a load factor between 3/8 and 3/4.
+ * IPv6 nodes are rare and kept in an EndpointSet.
+ */
+class NodeSet
+{
+public:
+    NodeSet() :
+        used4(0)
+    { }
+
+    /**
+     * Insert the address of a node. Returns true if it wasn't in the set.
+     */
+    bool insert(const sockaddr *sa, int salen)
+    {
+        if(sa->sa_family == AF_INET and salen >= (int) sizeof(sockaddr_in))
+            return insert4(key((const sockaddr_in *) sa));
+        if(sa->sa_family == AF_INET6 and salen >= (int) sizeof(sockaddr_in6))
+            return nodes6.insert(Endpoint::fromSockaddr(*(const sockaddr_in6 *) sa));
+        return false;
+    }
+
+    size_t size4() const
+    {
+        return used4;
+    }
+
+    size_t size6() const
+    {
+        return nodes6.size();
+    }
+
+    /**
+     * Bytes allocated for both tables
+     */
+    size_t memoryUsage() const
+    {
+        return table4.capacity() * sizeof(uint64_t) + nodes6.memoryUsage();
+    }
+
+private:
+    /* Bit 48 is set in every key, so zero marks an empty slot */
+    static uint64_t key(const sockaddr_in *sin)
+    {
+        uint32_t addr;
+        uint16_t port;
+        memcpy(&addr, &sin->sin_addr, 4);
+        memcpy(&port, &sin->sin_port, 2);
+        return (uint64_t(1) << 48) | (uint64_t(addr) << 16) | port;
+    }
+
+    static size_t hash(uint64_t k)
+    {
+        k ^= k >> 33;
+        k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33;
+        return k;
+    }
+
+    bool insert4(uint64_t k)
+    {
+        if(4 * (used4 + 1) > 3 * table4.size())
+            grow4();
+
+        size_t mask = table4.size() - 1;
+        for(size_t i = hash(k) & mask; ; i = (i + 1) & mask) {
+            if(table4[i] == 0) {
+                table4[i] = k;
+                used4++;
+                return true;
+            }
+            if(table4[i] == k)
+                return false;
+        }
+    }
+
+    void grow4(void)
+    {
+        std::vector<uint64_t> bigger(table4.empty() ? 4096 : table4.size() * 2);
+        size_t mask = bigger.size() - 1;
+        for(uint64_t k : table4) {
+            if(k == 0)
+                continue;
+            size_t i = hash(k) & mask;
+            while(bigger[i] != 0)
+                i = (i + 1) & mask;
+            bigger[i] = k;
+        }
+        table4.swap(bigger);
+    }
+
+    std::vector<uint64_t> table4;   /* Size is zero or a power of two */
+    size_t used4;
+    EndpointSet nodes6;
+};
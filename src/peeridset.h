@@ -0,0 +1,115 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+/**
+ * Set of peer ids from the PeerTable, kept as a sorted vector. Each peer
+ * takes four bytes.
+ *
+ * Only peers that are new to the process get ids above all ids of the
+ * set. Peers that other searches found before have lower ids, so they
+ * are appended unsorted behind the sorted part and merged in at once by
+ * merge(), instead of moving the tail of the vector for every insert.
+ */
+class PeerIdSet
+{
+public:
+    PeerIdSet() :
+        sortedSize(0)
+    { }
+
+    /**
+     * Insert an id. Returns true if it wasn't in the set.
+     */
+    bool insert(uint32_t id)
+    {
+        if(sortedSize == ids.size() and (ids.empty() or ids.back() < id)) {
+            ids.push_back(id);
+            sortedSize++;
+            return true;
+        }
+
+        if(contains(id))
+            return false;
+
+        ids.push_back(id);
+        if(ids.size() - sortedSize >= maxUnsorted)
+            merge();
+        return true;
+    }
+
+    bool contains(uint32_t id) const
+    {
+        auto middle = ids.begin() + sortedSize;
+        return std::binary_search(ids.begin(), middle, id) or
+               std::find(middle, ids.end(), id) != ids.end();
+    }
+
+    /**
+     * Sort the ids inserted out of order into the set. Must be called
+     * after a batch of inserts, before sorted() or forEach().
+     */
+    void merge()
+    {
+        if(sortedSize == ids.size())
+            return;
+
+        auto middle = ids.begin() + sortedSize;
+        std::sort(middle, ids.end());
+        std::inplace_merge(ids.begin(), middle, ids.end());
+        sortedSize = ids.size();
+    }
+
+    size_t size() const
+    {
+        return ids.size();
+    }
+
+    /**
+     * Bytes allocated for the ids
+     */
+    size_t memoryUsage() const
+    {
+        return ids.capacity() * sizeof(uint32_t);
+    }
+
+    const std::vector<uint32_t> &sorted() const
+    {
+        return ids;
+    }
+
+    template<typename F>
+    void forEach(F f) const
+    {
+        for(uint32_t id : ids)
+            f(id);
+    }
+
+private:
+    /* Unsorted ids that trigger a merge, bounds the linear search in contains() */
+    static const size_t maxUnsorted = 64;
+
+    std::vector<uint32_t> ids;  /* Sorted up to sortedSize, then in insertion order */
+    size_t sortedSize;
+};
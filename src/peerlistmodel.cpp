@@ -0,0 +1,94 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+
+#include "peerlistmodel.h"
+#include "codec.h"
+
+
+PeerListModel::PeerListModel(QObject *parent) :
+    QAbstractListModel(parent)
+{
+
+}
+
+/**
+ * Remove and insert nodes. Both lists must be sorted.
+ */
+void PeerListModel::applyChanges(const QVector<Endpoint> &added, const QVector<Endpoint> &removed)
+{
+    /* Rebuilding is cheaper than many single row changes */
+    if(added.size() + removed.size() > 64) {
+        beginResetModel();
+
+        QVector<Endpoint> remaining;
+        remaining.reserve(nodes.size());
+        std::set_difference(nodes.constBegin(), nodes.constEnd(),
+                            removed.constBegin(), removed.constEnd(),
+                            std::back_inserter(remaining));
+
+        nodes.clear();
+        nodes.reserve(remaining.size() + added.size());
+        std::merge(remaining.constBegin(), remaining.constEnd(),
+                   added.constBegin(), added.constEnd(),
+                   std::back_inserter(nodes));
+
+        endResetModel();
+        return;
+    }
+
+    for(auto &e : removed) {
+        auto it = std::lower_bound(nodes.begin(), nodes.end(), e);
+        if(it == nodes.end() or *it != e)
+            continue;
+
+        int row = it - nodes.begin();
+        beginRemoveRows(QModelIndex(), row, row);
+        nodes.remove(row);
+        endRemoveRows();
+    }
+
+    for(auto &e : added) {
+        auto it = std::lower_bound(nodes.begin(), nodes.end(), e);
+        if(it != nodes.end() and *it == e)
+            continue;
+
+        int row = it - nodes.begin();
+        beginInsertRows(QModelIndex(), row, row);
+        nodes.insert(row, e);
+        endInsertRows();
+    }
+}
+
+int PeerListModel::rowCount(const QModelIndex &parent) const
+{
+    if(parent.isValid())
+        return 0;
+    return nodes.size();
+}
+
+QVariant PeerListModel::data(const QModelIndex &index, int role) const
+{
+    if(not index.isValid() or index.row() >= nodes.size())
+        return QVariant();
+
+    if(role == Qt::DisplayRole)
+        return Codec::endpointToString(nodes[index.row()]);
+
+    return QVariant();
+}
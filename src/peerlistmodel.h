@@ -0,0 +1,45 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QAbstractListModel>
+#include <QVector>
+
+#include "endpoint.h"
+
+
+/**
+ * Sorted list of the nodes in the routing table. The model is updated
+ * with the nodes added and removed since the last update, addresses are
+ * only formatted when a row is displayed.
+ */
+class PeerListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    explicit PeerListModel(QObject *parent = 0);
+
+    void applyChanges(const QVector<Endpoint> &added, const QVector<Endpoint> &removed);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+private:
+    QVector<Endpoint> nodes;    /* Sorted list of nodes */
+};
@@ -0,0 +1,102 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "endpoint.h"
+
+
+/**
+ * Process-wide table of unique peer endpoints. Every endpoint gets a
+ * 32 bit id when it is seen for the first time, so result sets only
+ * store ids and a peer seen in many swarms is stored once. Ids are
+ * never reused, which makes them comparable across searches.
+ *
+ * Only used from the engine thread.
+ */
+class PeerTable
+{
+public:
+    PeerTable() :
+        used(0)
+    { }
+
+    static PeerTable &global(void);
+
+    /**
+     * Return the id of an endpoint, adding it if it is new
+     */
+    uint32_t intern(const Endpoint &e)
+    {
+        if(4 * (used + 1) > 3 * index.size())
+            grow();
+
+        size_t mask = index.size() - 1;
+        for(size_t i = e.hash() & mask; ; i = (i + 1) & mask) {
+            if(index[i] == 0) {
+                endpoints.push_back(e);
+                index[i] = endpoints.size();
+                used++;
+                return index[i] - 1;
+            }
+            if(endpoints[index[i] - 1] == e)
+                return index[i] - 1;
+        }
+    }
+
+    const Endpoint &endpoint(uint32_t id) const
+    {
+        return endpoints[id];
+    }
+
+    size_t size() const
+    {
+        return endpoints.size();
+    }
+
+    /**
+     * Bytes allocated for the endpoints and the index
+     */
+    size_t memoryUsage() const
+    {
+        return endpoints.capacity() * sizeof(Endpoint) + index.capacity() * sizeof(uint32_t);
+    }
+
+private:
+    void grow(void)
+    {
+        std::vector<uint32_t> bigger(index.empty() ? 1024 : index.size() * 2);
+        size_t mask = bigger.size() - 1;
+        for(uint32_t slot : index) {
+            if(slot == 0)
+                continue;
+            size_t i = endpoints[slot - 1].hash() & mask;
+            while(bigger[i] != 0)
+                i = (i + 1) & mask;
+            bigger[i] = slot;
+        }
+        index.swap(bigger);
+    }
+
+    std::vector<Endpoint> endpoints;    /* Endpoint of every id */
+    std::vector<uint32_t> index;        /* Hash table of id + 1, zero is empty, size is a power of two */
+    size_t used;
+};
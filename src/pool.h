@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Allocates objects of one type from chunks of chunkSize slots. Freed
+ * slots are kept in a list and reused, so creating and destroying an
+ * object doesn't call the allocator once the pool has grown. Objects
+ * still alive when the pool is destroyed are not destructed.
+ */
+template<typename T, size_t chunkSize = 256>
+class Pool
+{
+public:
+    Pool() :
+        freeList(nullptr),
+        used(0)
+    { }
+
+    ~Pool()
+    {
+        for(Slot *chunk : chunks)
+            delete[] chunk;
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    template<typename... Args>
+    T *create(Args &&... args)
+    {
+        if(not freeList)
+            grow();
+
+        Slot *slot = freeList;
+        freeList = slot->next;
+        used++;
+        return new (&slot->storage) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(T *object)
+    {
+        if(not object)
+            return;
+
+        object->~T();
+        Slot *slot = reinterpret_cast<Slot *>(object);
+        slot->next = freeList;
+        freeList = slot;
+        used--;
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    /**
+     * Bytes allocated for the chunks
+     */
+    size_t memoryUsage() const
+    {
+        return chunks.size() * chunkSize * sizeof(Slot);
+    }
+
+private:
+    union Slot
+    {
+        Slot *next;         /* Next free slot */
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+
+    void grow(void)
+    {
+        Slot *chunk = new Slot[chunkSize];
+        for(size_t i=0; i<chunkSize; i++)
+            chunk[i].next = i + 1 < chunkSize ? &chunk[i + 1] : freeList;
+        freeList = chunk;
+        chunks.push_back(chunk);
+    }
+
+    std::vector<Slot *> chunks;
+    Slot *freeList;
+    size_t used;
+};
@@ -0,0 +1,189 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <ctime>
+
+#include "reactor.h"
+
+
+/* Flag in the epoll data of timers, sockets and timers use their index */
+static const uint32_t timerFlag = 0x80000000;
+
+Reactor::Reactor() :
+    epfd(-1),
+    running(false),
+    counters()
+{
+
+}
+
+Reactor::~Reactor()
+{
+    for(auto &t : timers)
+        ::close(t.fd);
+    if(epfd >= 0)
+        ::close(epfd);
+}
+
+/**
+ * Create the descriptors. Returns false on failure, errno is set.
+ */
+bool Reactor::init(void)
+{
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    return epfd >= 0;
+}
+
+/**
+ * Call handler whenever s is readable. The handler should drain the
+ * socket, the reactor is level triggered.
+ */
+bool Reactor::addSocket(int s, const SocketHandler &handler)
+{
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = sockets.size();
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, s, &ev) < 0)
+        return false;
+
+    sockets.push_back(std::make_pair(s, handler));
+    return true;
+}
+
+/**
+ * Create a timer that calls handler. Returns the ID of the timer or -1
+ * on failure, errno is set.
+ */
+int Reactor::addTimer(const TimerHandler &handler)
+{
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0)
+        return -1;
+
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.u32 = timerFlag | timers.size();
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ::close(fd);
+        return -1;
+    }
+
+    Timer t;
+    t.fd = fd;
+    t.armed = -1;
+    t.handler = handler;
+    timers.push_back(t);
+    return timers.size() - 1;
+}
+
+void Reactor::scheduleAt(int timer, int64_t deadline)
+{
+    Timer &t = timers[timer];
+
+    /* An earlier deadline is still pending, the handler schedules again then */
+    if(t.armed >= 0 and t.armed <= deadline)
+        return;
+
+    arm(t, deadline);
+}
+
+void Reactor::scheduleIn(int timer, int64_t ms)
+{
+    scheduleAt(timer, now() + (ms > 0 ? ms : 0));
+}
+
+/**
+ * Set a timer. A deadline of -1 disarms it, which also clears an
+ * expiration that wasn't read.
+ */
+void Reactor::arm(Timer &t, int64_t deadline)
+{
+    itimerspec its = {};
+    if(deadline >= 0) {
+        its.it_value.tv_sec = deadline / 1000;
+        its.it_value.tv_nsec = (deadline % 1000) * 1000000;
+        /* A zero value would disarm the timer */
+        if(deadline == 0)
+            its.it_value.tv_nsec = 1;
+    }
+
+    timerfd_settime(t.fd, TFD_TIMER_ABSTIME, &its, nullptr);
+    counters.timerArms++;
+    t.armed = deadline;
+}
+
+/**
+ * Wait up to timeout milliseconds, -1 for no limit, and call the handlers
+ * of the ready descriptors. Returns the number of ready descriptors or
+ * -1 on error.
+ */
+int Reactor::dispatch(int timeout)
+{
+    epoll_event events[8];
+
+    int n = epoll_wait(epfd, events, 8, timeout);
+    counters.waits++;
+    if(n < 0)
+        return errno == EINTR ? 0 : -1;
+    counters.events += n;
+
+    for(int i=0; i<n; i++) {
+        uint32_t id = events[i].data.u32;
+        if(not (id & timerFlag)) {
+            sockets[id].second(sockets[id].first);
+            continue;
+        }
+
+        int timer = id & ~timerFlag;
+        counters.timerFired++;
+        timers[timer].armed = -1;
+        timers[timer].handler();
+
+        /* Setting the timer clears the expiration, so it only has to be
+         * disarmed if the handler didn't schedule again */
+        if(timers[timer].armed < 0)
+            arm(timers[timer], -1);
+    }
+
+    return n;
+}
+
+void Reactor::run(void)
+{
+    running = true;
+    while(running) {
+        if(dispatch(-1) < 0)
+            break;
+    }
+}
+
+void Reactor::stop(void)
+{
+    running = false;
+}
+
+int64_t Reactor::now(void)
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
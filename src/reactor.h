@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+
+/**
+ * Event loop backend for the DHT sockets, built on epoll and timerfd.
+ *
+ * The sockets and the timers share an epoll descriptor. Under Qt, a single
+ * QSocketNotifier on fd() calls dispatch(0), standalone programs call
+ * run(). Deadlines are in milliseconds on the monotonic clock. A timer
+ * is only re-armed when its deadline moves earlier, a later deadline
+ * costs an early wakeup in which the timer handler schedules again.
+ *
+ * Doesn't depend on Qt. All functions must be called from one thread.
+ */
+class Reactor
+{
+public:
+    typedef std::function<void(int s)> SocketHandler;
+    typedef std::function<void()> TimerHandler;
+
+    struct Stats {
+        uint64_t waits;         /* epoll_wait() calls */
+        uint64_t events;        /* Descriptors epoll_wait() returned */
+        uint64_t timerArms;     /* timerfd_settime() calls */
+        uint64_t timerFired;    /* Expirations of the timers */
+    };
+
+    Reactor();
+    ~Reactor();
+
+    bool init(void);
+    int fd(void) const { return epfd; }
+
+    bool addSocket(int s, const SocketHandler &handler);
+    int addTimer(const TimerHandler &handler);  /* Returns the timer ID or -1 */
+
+    void scheduleAt(int timer, int64_t deadline);   /* Call the handler at deadline */
+    void scheduleIn(int timer, int64_t ms);         /* Call the handler in ms milliseconds */
+
+    int dispatch(int timeout);              /* Wait up to timeout ms and handle the events */
+    void run(void);                         /* Dispatch until stop() is called */
+    void stop(void);
+
+    const Stats &stats(void) const { return counters; }
+
+    static int64_t now(void);               /* Monotonic time in milliseconds */
+
+private:
+    struct Timer {
+        int fd;                 /* timerfd */
+        int64_t armed;          /* Deadline, -1 if the timer isn't armed */
+        TimerHandler handler;
+    };
+
+    void arm(Timer &t, int64_t deadline);
+
+    int epfd;                   /* epoll descriptor */
+    bool running;
+    std::vector<std::pair<int, SocketHandler>> sockets;
+    std::vector<Timer> timers;
+    Stats counters;
+};
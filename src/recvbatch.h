@@ -0,0 +1,107 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cstring>
+#include <cstdint>
+
+
+/**
+ * Reusable ring of receive buffers for recvmmsg().
+ *
+ * The buffers are set up once and handed to the kernel on every call,
+ * so draining a socket doesn't allocate anything.
+ */
+class RecvBatch
+{
+public:
+    static const int size = 32;             /* Datagrams per recvmmsg() call */
+    static const int bufferSize = 4096;     /* Size of a single buffer */
+
+    RecvBatch()
+    {
+        memset(msgs, 0, sizeof(msgs));
+        for(int i=0; i<size; i++) {
+            /* Leave room for the terminating null byte dht_periodic() expects */
+            iov[i].iov_base = buffers[i];
+            iov[i].iov_len = bufferSize - 1;
+            msgs[i].msg_hdr.msg_iov = &iov[i];
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_name = &from[i];
+        }
+    }
+
+    /**
+     * Ask the kernel to attach the number of datagrams dropped on
+     * the socket to every received datagram (SO_RXQ_OVFL).
+     */
+    static bool enableDropCounter(int s)
+    {
+        int val = 1;
+        return setsockopt(s, SOL_SOCKET, SO_RXQ_OVFL, &val, sizeof(val)) == 0;
+    }
+
+    /**
+     * Receive up to size datagrams without blocking. Returns the number
+     * of datagrams or -1 on error, errno is set by recvmmsg().
+     */
+    int receive(int s)
+    {
+        for(int i=0; i<size; i++) {
+            msgs[i].msg_hdr.msg_namelen = sizeof(from[i]);
+            msgs[i].msg_hdr.msg_control = control[i];
+            msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+        }
+
+        int rc = recvmmsg(s, msgs, size, MSG_DONTWAIT, nullptr);
+        for(int i=0; i<rc; i++) {
+            buffers[i][msgs[i].msg_len] = '\0';
+        }
+        return rc;
+    }
+
+    char *data(int i) { return buffers[i]; }
+    int length(int i) const { return msgs[i].msg_len; }
+    sockaddr *source(int i) { return (sockaddr *) &from[i]; }
+    socklen_t sourceLength(int i) const { return msgs[i].msg_hdr.msg_namelen; }
+
+    /**
+     * Drop counter attached to datagram i. Returns false if the
+     * datagram doesn't carry one.
+     */
+    bool dropped(int i, uint32_t &count)
+    {
+        msghdr *hdr = &msgs[i].msg_hdr;
+        for(cmsghdr *c = CMSG_FIRSTHDR(hdr); c; c = CMSG_NXTHDR(hdr, c)) {
+            if(c->cmsg_level == SOL_SOCKET and c->cmsg_type == SO_RXQ_OVFL) {
+                memcpy(&count, CMSG_DATA(c), sizeof(count));
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    mmsghdr msgs[size];
+    iovec iov[size];
+    sockaddr_storage from[size];
+    alignas(cmsghdr) char control[size][CMSG_SPACE(sizeof(uint32_t))];
+    char buffers[size][bufferSize];
+};
@@ -0,0 +1,198 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <QDebug>
+#include <QDateTime>
+#include <QtEndian>
+#include "resultexporter.h"
+#include "codec.h"
+
+
+/* Buffers are handed to the writer when they reach this size */
+static const int bufferSize = 64 * 1024;
+
+
+ResultExporter::ResultExporter(Format format, QObject *parent) :
+    QThread(parent),
+    format(format),
+    bufferRecords(0),
+    dropped(0)
+{
+    buffer.reserve(bufferSize + 4096);
+
+    /* Partially filled buffers are written at least once a second */
+    flushTimer = new QTimer(this);
+    connect(flushTimer, &QTimer::timeout, this, &ResultExporter::flush);
+}
+
+ResultExporter::~ResultExporter()
+{
+    close();
+}
+
+/**
+ * Open the output file and start the writer. Results are appended
+ * to existing files.
+ */
+bool ResultExporter::open(const QString &path)
+{
+    file.setFileName(path);
+    if(not file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qCritical() << "Can't open" << path << file.errorString();
+        return false;
+    }
+
+    flushTimer->start(1000);
+    start();
+    return true;
+}
+
+/**
+ * Write all remaining records and stop the writer
+ */
+void ResultExporter::close(void)
+{
+    if(not isRunning())
+        return;
+
+    flushTimer->stop();
+    flush();
+
+    /* Every buffer in the queue has its own token, the extra
+     * token lets the writer return once the queue is empty. */
+    pending.release();
+    wait();
+
+    file.close();
+
+    if(dropped > 0) {
+        qWarning() << "Export dropped" << dropped << "records";
+    }
+}
+
+/**
+ * Encode the new peers of a search
+ */
+void ResultExporter::record(const NodeId &hash, const QVector<Endpoint> &peers)
+{
+    if(peers.isEmpty())
+        return;
+
+    qint64 time = QDateTime::currentMSecsSinceEpoch();
+    if(format == NdJson)
+        encodeJson(hash, time, peers);
+    else
+        encodeBinary(hash, time, peers);
+    bufferRecords++;
+
+    if(buffer.size() >= bufferSize)
+        flush();
+}
+
+/**
+ * Hand the current buffer to the writer thread
+ */
+void ResultExporter::flush(void)
+{
+    if(buffer.isEmpty())
+        return;
+
+    if(queue.push(std::move(buffer))) {
+        pending.release();
+    }
+    else {
+        dropped += bufferRecords;
+    }
+
+    bufferRecords = 0;
+    buffer = QByteArray();
+    buffer.reserve(bufferSize + 4096);
+}
+
+/**
+ * Writer thread
+ */
+void ResultExporter::run(void)
+{
+    QByteArray data;
+
+    for(;;) {
+        pending.acquire();
+        if(not queue.pop(data))
+            break;      /* Only the stop request is left */
+
+        if(file.write(data) != data.size()) {
+            qWarning() << "Export failed:" << file.errorString();
+        }
+        file.flush();
+    }
+}
+
+void ResultExporter::encodeJson(const NodeId &hash, qint64 time, const QVector<Endpoint> &peers)
+{
+    buffer.append("{\"hash\":\"");
+    Codec::appendId(buffer, hash);
+    buffer.append("\",\"time\":");
+    buffer.append(QByteArray::number(time));
+    buffer.append(",\"peers\":[");
+
+    for(int i=0; i<peers.size(); i++) {
+        if(i > 0)
+            buffer.append(',');
+        buffer.append('"');
+        Codec::appendEndpoint(buffer, peers[i]);
+        buffer.append('"');
+    }
+    buffer.append("]}\n");
+}
+
+void ResultExporter::encodeBinary(const NodeId &hash, qint64 time, const QVector<Endpoint> &peers)
+{
+    quint16 n4 = 0, n6 = 0;
+    for(auto &p : peers) {
+        if(p.family == 4)
+            n4++;
+        else
+            n6++;
+    }
+
+    quint32 length = NodeId::size + 8 + 2 + 2 + 6 * n4 + 18 * n6;
+    int offset = buffer.size();
+    buffer.resize(offset + 4 + length);
+    uchar *out = (uchar *) buffer.data() + offset;
+
+    qToBigEndian<quint32>(length, out);
+    memcpy(out + 4, hash.data, NodeId::size);
+    qToBigEndian<quint64>((quint64) time, out + 24);
+    qToBigEndian<quint16>(n4, out + 32);
+    qToBigEndian<quint16>(n6, out + 34);
+
+    uchar *p4 = out + 36;
+    uchar *p6 = p4 + 6 * n4;
+    for(auto &p : peers) {
+        if(p.family == 4) {
+            memcpy(p4, p.addr, 4);
+            memcpy(p4 + 4, p.port, 2);
+            p4 += 6;
+        }
+        else {
+            memcpy(p6, p.addr, 16);
+            memcpy(p6 + 16, p.port, 2);
+            p6 += 18;
+        }
+    }
+}
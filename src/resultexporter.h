@@ -0,0 +1,86 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QThread>
+#include <QFile>
+#include <QTimer>
+#include <QSemaphore>
+#include <QVector>
+
+#include "endpoint.h"
+#include "nodeid.h"
+#include "spscqueue.h"
+
+
+/**
+ * Appends search results to a file while the searches are running.
+ *
+ * Records are encoded on the calling thread into a buffer, full buffers
+ * are handed to a writer thread. If the writer can't keep up, records
+ * are dropped instead of blocking the caller.
+ *
+ * NDJSON records look like
+ *   {"hash":"<hex>","time":<ms since epoch>,"peers":["1.2.3.4:6881","[::1]:6881"]}
+ *
+ * Binary records use network byte order:
+ *   u32 length of the rest of the record
+ *   u8[20] info hash
+ *   u64 ms since epoch
+ *   u16 number of IPv4 peers, u16 number of IPv6 peers
+ *   IPv4 peers in compact format (6 bytes each)
+ *   IPv6 peers in compact format (18 bytes each)
+ */
+class ResultExporter : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        NdJson,
+        Binary,
+    };
+
+    ResultExporter(Format format, QObject *parent = 0);
+    ~ResultExporter();
+
+    bool open(const QString &path);
+    void close(void);
+
+    void record(const NodeId &hash, const QVector<Endpoint> &peers);
+
+public slots:
+    void flush(void);           /* Hand the current buffer to the writer */
+
+protected:
+    void run(void) override;
+
+private:
+    void encodeJson(const NodeId &hash, qint64 time, const QVector<Endpoint> &peers);
+    void encodeBinary(const NodeId &hash, qint64 time, const QVector<Endpoint> &peers);
+
+    Format format;
+    QFile file;
+    QByteArray buffer;          /* Records not yet handed to the writer */
+    int bufferRecords;          /* Number of records in the buffer */
+    QTimer *flushTimer;
+
+    SpscQueue<QByteArray, 64> queue;    /* Buffers for the writer */
+    QSemaphore pending;                 /* Number of buffers in the queue */
+    quint64 dropped;                    /* Records dropped because the queue was full */
+};
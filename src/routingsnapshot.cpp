@@ -0,0 +1,183 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <arpa/inet.h>
+#include <algorithm>
+#include <cstring>
+
+#include <QDebug>
+#include <QDataStream>
+#include <QFile>
+#include <QSaveFile>
+#include <QVector>
+#include "routingsnapshot.h"
+#include "dhtinternal.h"
+#include "dht/dht.h"
+
+
+static const quint32 magic = 0x44485453;    /* "DHTS" */
+static const quint32 version = 1;
+
+/* Number of restored nodes that are pinged right away */
+static const int pingCount = 32;
+
+struct SnapshotNode
+{
+    quint8 family;
+    unsigned char id[20];
+    unsigned char addr[16];
+    quint16 port;           /* Host byte order */
+    qint64 time;
+    qint64 replyTime;
+};
+
+static void collectNode(void *closure, const unsigned char *id,
+                        const sockaddr *sa, int salen,
+                        time_t time, time_t reply_time)
+{
+    auto nodes = static_cast<QVector<SnapshotNode> *>(closure);
+
+    SnapshotNode n;
+    memset(&n, 0, sizeof(n));
+    memcpy(n.id, id, 20);
+    n.time = time;
+    n.replyTime = reply_time;
+
+    if(sa->sa_family == AF_INET) {
+        auto sin = (const sockaddr_in *) sa;
+        n.family = 4;
+        memcpy(n.addr, &sin->sin_addr, 4);
+        n.port = ntohs(sin->sin_port);
+    }
+    else if(sa->sa_family == AF_INET6) {
+        auto sin6 = (const sockaddr_in6 *) sa;
+        n.family = 6;
+        memcpy(n.addr, &sin6->sin6_addr, 16);
+        n.port = ntohs(sin6->sin6_port);
+    }
+    else {
+        return;
+    }
+
+    nodes->append(n);
+}
+
+/**
+ * Write the routing table to path. The file is replaced atomically.
+ */
+bool RoutingSnapshot::save(const QString &path)
+{
+    QVector<SnapshotNode> nodes;
+    dht_internal_foreach_node(collectNode, &nodes);
+
+    QSaveFile file(path);
+    if(not file.open(QIODevice::WriteOnly)) {
+        qWarning() << "Can't write routing table snapshot" << path;
+        return false;
+    }
+
+    QDataStream out(&file);
+    out << magic << version << (quint32) nodes.size();
+    for(auto &n : nodes) {
+        out << n.family;
+        out.writeRawData((const char *) n.id, 20);
+        out.writeRawData((const char *) n.addr, 16);
+        out << n.port << n.time << n.replyTime;
+    }
+
+    if(out.status() != QDataStream::Ok or not file.commit()) {
+        qWarning() << "Writing routing table snapshot failed";
+        return false;
+    }
+
+    qDebug() << "Saved" << nodes.size() << "nodes to" << path;
+    return true;
+}
+
+/**
+ * Insert the nodes of a snapshot into the routing table. af4 and af6
+ * select the families to load. The most recently seen nodes are also
+ * pinged, so they are confirmed quickly. Returns the number of nodes
+ * inserted or -1 on error.
+ */
+int RoutingSnapshot::load(const QString &path, int af4, int af6)
+{
+    QFile file(path);
+    if(not file.open(QIODevice::ReadOnly))
+        return -1;
+
+    QDataStream in(&file);
+    quint32 m, v, count;
+    in >> m >> v >> count;
+    if(in.status() != QDataStream::Ok or m != magic or v != version) {
+        qWarning() << "Invalid routing table snapshot" << path;
+        return -1;
+    }
+
+    QVector<SnapshotNode> nodes;
+    nodes.reserve(std::min<quint32>(count, 16384));
+    for(quint32 i=0; i<count; i++) {
+        SnapshotNode n;
+        in >> n.family;
+        in.readRawData((char *) n.id, 20);
+        in.readRawData((char *) n.addr, 16);
+        in >> n.port >> n.time >> n.replyTime;
+
+        if(in.status() != QDataStream::Ok)
+            break;
+
+        if((n.family == 4 and af4) or (n.family == 6 and af6))
+            nodes.append(n);
+    }
+
+    /* Most recently seen nodes first */
+    std::sort(nodes.begin(), nodes.end(), [](const SnapshotNode &a, const SnapshotNode &b) {
+        return a.time > b.time;
+    });
+
+    int inserted = 0;
+    for(int i=0; i<nodes.size(); i++) {
+        auto &n = nodes[i];
+
+        sockaddr_storage ss;
+        socklen_t salen;
+        memset(&ss, 0, sizeof(ss));
+
+        if(n.family == 4) {
+            auto sin = (sockaddr_in *) &ss;
+            sin->sin_family = AF_INET;
+            memcpy(&sin->sin_addr, n.addr, 4);
+            sin->sin_port = htons(n.port);
+            salen = sizeof(sockaddr_in);
+        }
+        else {
+            auto sin6 = (sockaddr_in6 *) &ss;
+            sin6->sin6_family = AF_INET6;
+            memcpy(&sin6->sin6_addr, n.addr, 16);
+            sin6->sin6_port = htons(n.port);
+            salen = sizeof(sockaddr_in6);
+        }
+
+        if(dht_insert_node(n.id, (sockaddr *) &ss, salen) > 0)
+            inserted++;
+
+        if(i < pingCount)
+            dht_ping_node((sockaddr *) &ss, salen);
+    }
+
+    return inserted;
+}
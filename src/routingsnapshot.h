@@ -0,0 +1,37 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QString>
+
+
+/**
+ * Binary snapshot of the routing table. Unlike the node list in the
+ * configuration file, it contains the node ids, so the nodes can be
+ * inserted into the routing table directly instead of being pinged.
+ *
+ * The file starts with the magic "DHTS", a version and the number of
+ * nodes. Each node is stored as family (4 or 6), id, address, port,
+ * time of the last message and time of the last reply.
+ */
+class RoutingSnapshot
+{
+public:
+    static bool save(const QString &path);
+    static int load(const QString &path, int af4, int af6);
+};
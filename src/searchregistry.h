@@ -0,0 +1,141 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include "nodeid.h"
+
+
+/**
+ * Open addressing hash table from info hash to search. Uses linear
+ * probing and backward shift deletion, so there are no tombstones and
+ * lookups never allocate.
+ */
+template<typename T>
+class SearchRegistry
+{
+public:
+    SearchRegistry() :
+        table(16),
+        used(0)
+    { }
+
+    T *find(const NodeId &id) const
+    {
+        size_t mask = table.size() - 1;
+        for(size_t i = id.hash() & mask; ; i = (i + 1) & mask) {
+            const Slot &s = table[i];
+            if(not s.value)
+                return nullptr;
+            if(s.id == id)
+                return s.value;
+        }
+    }
+
+    /**
+     * Insert a new entry. Returns false if the id already exists.
+     */
+    bool insert(const NodeId &id, T *value)
+    {
+        /* Keep the load factor below 0.5 */
+        if(2 * (used + 1) > table.size())
+            grow();
+
+        size_t mask = table.size() - 1;
+        for(size_t i = id.hash() & mask; ; i = (i + 1) & mask) {
+            Slot &s = table[i];
+            if(not s.value) {
+                s.id = id;
+                s.value = value;
+                used++;
+                return true;
+            }
+            if(s.id == id)
+                return false;
+        }
+    }
+
+    /**
+     * Remove an entry and return its value, or null if it doesn't exist.
+     */
+    T *remove(const NodeId &id)
+    {
+        size_t mask = table.size() - 1;
+        size_t i = id.hash() & mask;
+        for(; ; i = (i + 1) & mask) {
+            if(not table[i].value)
+                return nullptr;
+            if(table[i].id == id)
+                break;
+        }
+
+        T *value = table[i].value;
+
+        /* Move following entries of the cluster back into the gap */
+        size_t gap = i;
+        for(size_t j = (i + 1) & mask; table[j].value; j = (j + 1) & mask) {
+            size_t home = table[j].id.hash() & mask;
+            if(((j - home) & mask) >= ((j - gap) & mask)) {
+                table[gap] = table[j];
+                gap = j;
+            }
+        }
+        table[gap].value = nullptr;
+        used--;
+
+        return value;
+    }
+
+    size_t size() const
+    {
+        return used;
+    }
+
+    template<typename F>
+    void forEach(F f) const
+    {
+        for(auto &s : table) {
+            if(s.value)
+                f(s.value);
+        }
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : value(nullptr) { }
+
+        NodeId id;
+        T *value;       /* Null for empty table */
+    };
+
+    void grow(void)
+    {
+        std::vector<Slot> old(table.size() * 2);
+        old.swap(table);
+        used = 0;
+        for(auto &s : old) {
+            if(s.value)
+                insert(s.id, s.value);
+        }
+    }
+
+    std::vector<Slot> table;    /* Size is a power of two */
+    size_t used;
+};
@@ -0,0 +1,221 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "sendqueue.h"
+
+
+SendQueue::SendQueue(Reactor *reactor) :
+    reactor(reactor),
+    timer(-1),
+    rate(0),
+    burst(1),
+    maxDepth(1024),
+    tokens(1),
+    lastRefill(Reactor::now()),
+    counters()
+{
+
+}
+
+/**
+ * Create the timer for paced sends. Returns false on failure.
+ */
+bool SendQueue::init(void)
+{
+    timer = reactor->addTimer([this]() { flush(); });
+    return timer >= 0;
+}
+
+/**
+ * Send at most rate packets per second with bursts of up to burst
+ * packets, and queue at most depth messages per socket. A rate of 0
+ * disables the pacing.
+ */
+void SendQueue::setLimits(unsigned rate, unsigned burst, unsigned depth)
+{
+    this->rate = rate;
+    this->burst = std::max(burst, 1u);
+    this->maxDepth = std::max(depth, 1u);
+    tokens = this->burst;
+    lastRefill = Reactor::now();
+}
+
+SendQueue::Queue &SendQueue::queueFor(int s)
+{
+    for(auto &q : queues) {
+        if(q.s == s)
+            return q;
+    }
+
+    Queue q;
+    q.s = s;
+    q.head = 0;
+    q.count = 0;
+    q.blocked = false;
+    queues.push_back(q);
+    return queues.back();
+}
+
+/**
+ * Queue a datagram, same arguments as sendto(). Returns len, or -1 with
+ * errno set to EAGAIN if the queue is full.
+ */
+ssize_t SendQueue::enqueue(int s, const void *buf, size_t len, const sockaddr *to, socklen_t tolen)
+{
+    Queue &q = queueFor(s);
+    if(q.count >= maxDepth or tolen > sizeof(sockaddr_storage)) {
+        counters.dropped++;
+        errno = EAGAIN;
+        return -1;
+    }
+
+    /* The ring grows up to the maximum depth and keeps its buffers */
+    if(q.count == q.ring.size()) {
+        q.ring.insert(q.ring.begin() + q.head, Message());
+        if(q.count > 0)
+            q.head++;
+    }
+
+    Message &m = q.ring[(q.head + q.count) % q.ring.size()];
+    m.data.assign((const char *) buf, (const char *) buf + len);
+    m.length = len;
+    memcpy(&m.to, to, tolen);
+    m.tolen = tolen;
+    q.count++;
+    return len;
+}
+
+void SendQueue::refill(int64_t now)
+{
+    if(rate == 0)
+        return;
+
+    tokens = std::min<double>(burst, tokens + (now - lastRefill) * rate / 1000.0);
+    lastRefill = now;
+}
+
+/**
+ * Send up to n messages from the head of q with one sendmmsg() call.
+ * Returns the number of messages removed from the queue.
+ */
+int SendQueue::send(Queue &q, int n)
+{
+    mmsghdr msgs[batchSize];
+    iovec iov[batchSize];
+
+    memset(msgs, 0, n * sizeof(msgs[0]));
+    for(int i=0; i<n; i++) {
+        Message &m = q.ring[(q.head + i) % q.ring.size()];
+        iov[i].iov_base = m.data.data();
+        iov[i].iov_len = m.length;
+        msgs[i].msg_hdr.msg_iov = &iov[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &m.to;
+        msgs[i].msg_hdr.msg_namelen = m.tolen;
+    }
+
+    int rc = sendmmsg(q.s, msgs, n, MSG_DONTWAIT);
+    counters.calls++;
+
+    int removed;
+    if(rc > 0) {
+        for(int i=0; i<rc; i++) {
+            Message &m = q.ring[(q.head + i) % q.ring.size()];
+            if(m.to.ss_family == AF_INET) {
+                counters.sent4++;
+                counters.bytes4 += m.length;
+            }
+            else {
+                counters.sent6++;
+                counters.bytes6 += m.length;
+            }
+        }
+        removed = rc;
+    }
+    else if(errno == EAGAIN or errno == EWOULDBLOCK or errno == ENOBUFS or errno == EINTR) {
+        /* Try again when the kernel had time to send */
+        counters.retries++;
+        q.blocked = true;
+        return 0;
+    }
+    else {
+        /* The first message was rejected, e.g. an unreachable address */
+        counters.errors++;
+        removed = 1;
+    }
+
+    q.head = (q.head + removed) % q.ring.size();
+    q.count -= removed;
+    return removed;
+}
+
+/**
+ * Send as many queued messages as the pacing allows. If messages are
+ * left, the timer flushes again when they may be sent.
+ */
+void SendQueue::flush(void)
+{
+    int64_t now = Reactor::now();
+    refill(now);
+
+    for(auto &q : queues)
+        q.blocked = false;
+
+    /* Take turns between the sockets */
+    bool progress = true;
+    while(progress) {
+        progress = false;
+        for(auto &q : queues) {
+            if(q.count == 0 or q.blocked)
+                continue;
+
+            int n = std::min<size_t>(q.count, batchSize);
+            if(rate > 0)
+                n = std::min<int>(n, int(tokens));
+            if(n == 0)
+                break;
+
+            int removed = send(q, n);
+            if(rate > 0)
+                tokens -= removed;
+            progress |= removed > 0;
+        }
+    }
+
+    if(depth() == 0)
+        return;
+
+    /* Wait for the next token or give the kernel a moment */
+    int64_t wait = 1;
+    if(rate > 0 and tokens < 1)
+        wait = std::max<int64_t>(1, std::ceil((1 - tokens) * 1000 / rate));
+    reactor->scheduleIn(timer, wait);
+}
+
+int SendQueue::depth(void) const
+{
+    int n = 0;
+    for(auto &q : queues)
+        n += q.count;
+    return n;
+}
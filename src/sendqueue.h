@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#pragma once
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <cstdint>
+#include <vector>
+
+#include "reactor.h"
+
+
+/**
+ * Outbound queue for the datagrams dht.c sends.
+ *
+ * Messages are queued per socket and sent with sendmmsg() in batches
+ * when flush() is called, which the engine does after every call into
+ * dht.c. A token bucket paces the sends to a number of packets per
+ * second, so the fan-out of many searches doesn't overflow the kernel's
+ * send buffer. Messages that don't fit into the queue are dropped.
+ *
+ * The message buffers are reused, a queue doesn't allocate once it was
+ * full for the first time. Must be used from the thread running dht.c.
+ */
+class SendQueue
+{
+public:
+    static const int batchSize = 64;        /* Datagrams per sendmmsg() call */
+
+    struct Stats {
+        uint64_t sent4;         /* IPv4 datagrams the kernel accepted */
+        uint64_t sent6;         /* IPv6 datagrams the kernel accepted */
+        uint64_t bytes4;        /* Payload bytes of sent4 */
+        uint64_t bytes6;        /* Payload bytes of sent6 */
+        uint64_t dropped;       /* Datagrams dropped because the queue was full */
+        uint64_t errors;        /* Datagrams the kernel rejected */
+        uint64_t calls;         /* sendmmsg() calls */
+        uint64_t retries;       /* Calls that failed because the send buffer was full */
+    };
+
+    explicit SendQueue(Reactor *reactor);
+
+    bool init(void);
+    void setLimits(unsigned rate, unsigned burst, unsigned depth);
+
+    ssize_t enqueue(int s, const void *buf, size_t len, const sockaddr *to, socklen_t tolen);
+    void flush(void);
+
+    int depth(void) const;      /* Messages waiting in all queues */
+    const Stats &stats(void) const { return counters; }
+
+private:
+    struct Message {
+        std::vector<char> data;
+        size_t length;
+        sockaddr_storage to;
+        socklen_t tolen;
+    };
+
+    struct Queue {
+        int s;
+        std::vector<Message> ring;
+        size_t head;            /* Oldest message */
+        size_t count;
+        bool blocked;           /* The send buffer was full */
+    };
+
+    Queue &queueFor(int s);
+    int send(Queue &q, int n);
+    void refill(int64_t now);
+
+    Reactor *reactor;
+    int timer;                  /* Reactor timer for paced and blocked sends */
+    std::vector<Queue> queues;
+    unsigned rate;              /* Packets per second, 0 for no limit */
+    unsigned burst;
+    unsigned maxDepth;          /* Messages per queue */
+    double tokens;
+    int64_t lastRefill;
+    Stats counters;
+};
@@ -0,0 +1,46 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * SHA-1 with the SHA extensions of x86 CPUs, for the DHT tokens.
+ * sha1_digest3() may only be used if sha1_accelerated() returns true.
+ */
+
+/* True if the CPU supports the SHA extensions */
+int sha1_accelerated(void);
+
+/* Hash the concatenation of three buffers */
+void sha1_digest3(unsigned char md[20],
+                  const void *v1, size_t len1,
+                  const void *v2, size_t len2,
+                  const void *v3, size_t len3);
+
+/* Make sha1_accelerated() return false, for comparisons. Not thread-safe. */
+void sha1_disable(int disable);
+
+#ifdef __cplusplus
+}
+#endif
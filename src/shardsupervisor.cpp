@@ -0,0 +1,364 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include "shardsupervisor.h"
+#include "codec.h"
+
+
+/* Input lines routed per call of readInput() */
+static const int linesPerRead = 4096;
+
+/* Input reading pauses while a worker has more unwritten bytes */
+static const qint64 maxPendingInput = 4 << 20;
+
+/* Bytes read from the input at once */
+static const int readSize = 64 * 1024;
+
+
+ShardSupervisor::ShardSupervisor(int workers, QObject *parent) :
+    QObject(parent),
+    numWorkers(workers),
+    inputFd(-1),
+    inputFlags(0),
+    inputNotifier(nullptr),
+    bufferPos(0),
+    inputEnd(false),
+    metricsPort(0),
+    inputDone(false),
+    inputPaused(false),
+    lineNumber(0),
+    running(0),
+    failed(0)
+{
+
+}
+
+/**
+ * Stop the workers. They save their routing tables on SIGTERM.
+ */
+ShardSupervisor::~ShardSupervisor()
+{
+    for(auto &w : workers) {
+        disconnect(w.process, nullptr, this, nullptr);
+        if(w.process->state() != QProcess::NotRunning) {
+            w.process->terminate();
+            if(not w.process->waitForFinished(5000))
+                w.process->kill();
+        }
+    }
+    output.flush();
+
+    /* stdin may be shared with other processes */
+    if(inputFd >= 0)
+        fcntl(inputFd, F_SETFL, inputFlags);
+}
+
+/**
+ * Open the list of hashes. Returns true on success.
+ */
+bool ShardSupervisor::open(const QString &path)
+{
+    int fd;
+    if(path == "-") {
+        fd = STDIN_FILENO;
+    }
+    else {
+        input.setFileName(path);
+        fd = input.open(QIODevice::ReadOnly) ? input.handle() : -1;
+    }
+
+    int flags = fd >= 0 ? fcntl(fd, F_GETFL) : -1;
+    if(flags < 0 or fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+        qCritical() << "Can't open" << path;
+        return false;
+    }
+    inputFd = fd;
+    inputFlags = flags;
+
+    /* Only pipes and terminals ever wait, see nextLine() */
+    inputNotifier = new QSocketNotifier(inputFd, QSocketNotifier::Read, this);
+    inputNotifier->setEnabled(false);
+    connect(inputNotifier, &QSocketNotifier::activated, this, &ShardSupervisor::inputReady);
+
+    return output.open(stdout, QIODevice::WriteOnly);
+}
+
+/**
+ * Let every worker export its results to path.i
+ */
+void ShardSupervisor::setExport(const QString &path, const QString &format)
+{
+    exportPath = path;
+    exportFormat = format;
+}
+
+/**
+ * Let worker i serve its metrics on port + i
+ */
+void ShardSupervisor::setMetricsPort(int port)
+{
+    metricsPort = port;
+}
+
+/**
+ * Node ID in the middle of slice shard of shards equally sized slices
+ * of the keyspace. The lower bytes are random.
+ */
+NodeId ShardSupervisor::shardId(int shard, int shards)
+{
+    NodeId id;
+    for(int i=0; i<NodeId::size; i++)
+        id.data[i] = rand() % 256;
+
+    quint64 width = ~quint64(0) / quint64(shards);
+    quint64 prefix = width * quint64(shard) + width / 2;
+    for(int i=0; i<8; i++)
+        id.data[i] = prefix >> (56 - 8 * i);
+
+    return id;
+}
+
+/**
+ * Start the workers. Worker i listens on basePort + i. workerArgs are
+ * passed to every worker in addition to the batch options.
+ */
+bool ShardSupervisor::start(const QStringList &workerArgs, int basePort)
+{
+    auto program = QCoreApplication::applicationFilePath();
+
+    for(int i=0; i<numWorkers; i++) {
+        Worker w;
+        w.id = shardId(i, numWorkers);
+        w.process = new QProcess(this);
+        w.process->setProcessChannelMode(QProcess::ForwardedErrorChannel);
+        workers.append(w);
+    }
+
+    for(int i=0; i<numWorkers; i++) {
+        auto process = workers[i].process;
+        QStringList args = workerArgs;
+        args << "--batch" << "-"
+             << "--port" << QString::number(basePort + i)
+             << "--node-id" << Codec::idToString(workers[i].id);
+        if(not exportPath.isEmpty()) {
+            args << "--export" << QString("%1.%2").arg(exportPath).arg(i)
+                 << "--export-format" << exportFormat;
+        }
+        if(metricsPort > 0) {
+            args << "--metrics-port" << QString::number(metricsPort + i);
+        }
+
+        connect(process, &QProcess::readyReadStandardOutput, this, [this, i]() {
+            readOutput(workers[i]);
+        });
+        connect(process, &QProcess::bytesWritten, this, [this]() {
+            if(inputPaused and not backlogged()) {
+                inputPaused = false;
+                readInput();
+            }
+        });
+        connect(process, static_cast<void (QProcess::*)(int, QProcess::ExitStatus)>(&QProcess::finished),
+                this, &ShardSupervisor::workerFinished);
+
+        process->start(program, args);
+        if(not process->waitForStarted()) {
+            qCritical() << "Can't start worker" << i;
+            return false;
+        }
+        running++;
+        qInfo() << "Worker" << i << "on port" << basePort + i << "with ID"
+                << Codec::idToString(workers[i].id);
+    }
+
+    QMetaObject::invokeMethod(this, "readInput", Qt::QueuedConnection);
+    return true;
+}
+
+int ShardSupervisor::exitCode(void) const
+{
+    return failed > 0 ? 1 : 0;
+}
+
+/**
+ * Index of the worker whose ID is closest to id
+ */
+int ShardSupervisor::closestWorker(const NodeId &id) const
+{
+    int best = 0;
+    unsigned char bestDistance[NodeId::size];
+    memset(bestDistance, 0xff, sizeof(bestDistance));
+
+    for(int i=0; i<workers.size(); i++) {
+        unsigned char distance[NodeId::size];
+        for(int j=0; j<NodeId::size; j++)
+            distance[j] = id.data[j] ^ workers[i].id.data[j];
+
+        if(memcmp(distance, bestDistance, NodeId::size) < 0) {
+            memcpy(bestDistance, distance, NodeId::size);
+            best = i;
+        }
+    }
+    return best;
+}
+
+bool ShardSupervisor::backlogged(void) const
+{
+    for(auto &w : workers) {
+        if(w.process->bytesToWrite() > maxPendingInput)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Route a block of hashes to the workers. Reading continues from
+ * the event loop, so that the output of the workers is merged in between.
+ */
+void ShardSupervisor::readInput(void)
+{
+    if(inputDone or inputPaused)
+        return;
+
+    for(int n=0; n<linesPerRead; n++) {
+        QByteArray line;
+        if(not nextLine(line)) {
+            if(inputEnd) {
+                inputDone = true;
+                for(auto &w : workers)
+                    w.process->closeWriteChannel();
+            }
+            return;
+        }
+        lineNumber++;
+
+        line = line.trimmed();
+        if(line.isEmpty())
+            continue;
+
+        NodeId id;
+        if(not Codec::parseId(line, id)) {
+            qWarning() << "Ignoring invalid hash on line" << lineNumber;
+            continue;
+        }
+
+        auto &w = workers[closestWorker(id)];
+        line.append('\n');
+        w.process->write(line);
+    }
+
+    if(backlogged()) {
+        inputPaused = true;
+        return;
+    }
+    QMetaObject::invokeMethod(this, "readInput", Qt::QueuedConnection);
+}
+
+/**
+ * Take the next line from the input buffer and read more input if
+ * there is no complete line. Returns false at the end of the input,
+ * or if there is no data right now and the notifier waits for it.
+ */
+bool ShardSupervisor::nextLine(QByteArray &line)
+{
+    for(;;) {
+        int end = buffer.indexOf('\n', bufferPos);
+
+        /* The last line may lack the newline */
+        if(end < 0 and inputEnd and bufferPos < buffer.size())
+            end = buffer.size();
+
+        if(end >= 0) {
+            line = buffer.mid(bufferPos, end - bufferPos);
+            bufferPos = std::min(end + 1, buffer.size());
+            return true;
+        }
+
+        if(inputEnd)
+            return false;
+
+        buffer.remove(0, bufferPos);
+        bufferPos = 0;
+
+        int size = buffer.size();
+        buffer.resize(size + readSize);
+        ssize_t n = ::read(inputFd, buffer.data() + size, readSize);
+        buffer.resize(size + std::max<ssize_t>(n, 0));
+
+        if(n < 0 and (errno == EAGAIN or errno == EWOULDBLOCK)) {
+            inputNotifier->setEnabled(true);
+            return false;
+        }
+
+        if(n < 0 and errno != EINTR) {
+            qWarning() << "Can't read the input:" << strerror(errno);
+            inputEnd = true;
+        }
+        else if(n == 0) {
+            inputEnd = true;
+        }
+    }
+}
+
+/**
+ * The input became readable while readInput() was waiting for it
+ */
+void ShardSupervisor::inputReady(void)
+{
+    inputNotifier->setEnabled(false);
+    readInput();
+}
+
+/**
+ * Copy complete result lines of a worker to stdout
+ */
+void ShardSupervisor::readOutput(Worker &worker)
+{
+    while(worker.process->canReadLine()) {
+        output.write(worker.process->readLine());
+    }
+    output.flush();
+}
+
+void ShardSupervisor::workerFinished(int exitCode, QProcess::ExitStatus status)
+{
+    auto process = qobject_cast<QProcess *>(sender());
+    for(auto &w : workers) {
+        if(w.process == process) {
+            readOutput(w);
+            break;
+        }
+    }
+
+    if(status != QProcess::NormalExit or exitCode != 0) {
+        qWarning() << "Worker exited with code" << exitCode;
+        failed++;
+    }
+
+    if(--running == 0) {
+        qInfo() << "All workers finished";
+        emit finished();
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QProcess>
+#include <QSocketNotifier>
+#include <QStringList>
+#include <QVector>
+
+#include "nodeid.h"
+
+
+/**
+ * Runs a batch search on several worker processes.
+ *
+ * Every worker is a headless instance of this program with its own port
+ * and a node ID in its own slice of the keyspace. Each hash is sent to the
+ * worker whose ID is closest by XOR distance, so that the searches of a
+ * worker start close to its own routing table. The result lines of all
+ * workers are merged into stdout.
+ *
+ * The input is read without blocking, so the output of the workers is
+ * merged while a pipe has no data and they never wait for stdout.
+ */
+class ShardSupervisor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit ShardSupervisor(int workers, QObject *parent = 0);
+    ~ShardSupervisor();
+
+    bool open(const QString &path);     /* "-" reads from stdin */
+    void setExport(const QString &path, const QString &format);
+    void setMetricsPort(int port);
+    bool start(const QStringList &workerArgs, int basePort);
+    int exitCode(void) const;           /* Non-zero if a worker failed */
+
+    static NodeId shardId(int shard, int shards);
+
+signals:
+    void finished();
+
+private slots:
+    void readInput(void);
+    void inputReady(void);              /* More input is available */
+    void workerFinished(int exitCode, QProcess::ExitStatus status);
+
+private:
+    struct Worker
+    {
+        QProcess *process;
+        NodeId id;
+    };
+
+    int closestWorker(const NodeId &id) const;
+    void readOutput(Worker &worker);
+    bool backlogged(void) const;        /* A worker has too much pending input */
+    bool nextLine(QByteArray &line);    /* False at the end or while waiting for input */
+
+    int numWorkers;
+    QVector<Worker> workers;
+    QFile input;
+    int inputFd;                /* Descriptor of the input, -1 if not open */
+    int inputFlags;             /* File status flags of the input before open() */
+    QSocketNotifier *inputNotifier; /* Enabled while waiting for input */
+    QByteArray buffer;          /* Input that wasn't routed yet, from bufferPos on */
+    int bufferPos;
+    bool inputEnd;              /* End of the input was read */
+    QFile output;
+    QString exportPath;         /* Worker i exports to exportPath.i */
+    QString exportFormat;
+    int metricsPort;            /* Worker i serves metrics on metricsPort + i, 0 if none */
+    bool inputDone;             /* All input was routed to the workers */
+    bool inputPaused;           /* Waiting for the workers to consume their input */
+    quint64 lineNumber;
+    int running;                /* Number of workers still running */
+    int failed;                 /* Number of workers that exited with an error */
+};
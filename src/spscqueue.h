@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+
+/**
+ * Bounded lock-free queue for exactly one producer and one consumer thread.
+ * The capacity must be a power of two.
+ */
+template<typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N > 0 and (N & (N - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    SpscQueue() :
+        head(0),
+        tail(0)
+    { }
+
+    /**
+     * Append an element. Returns false if the queue is full.
+     * Must only be called from the producer thread.
+     */
+    bool push(T &&value)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if(t - head.load(std::memory_order_acquire) == N)
+            return false;
+
+        items[t & (N - 1)] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Remove the oldest element. Returns false if the queue is empty.
+     * Must only be called from the consumer thread.
+     */
+    bool pop(T &value)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if(h == tail.load(std::memory_order_acquire))
+            return false;
+
+        value = std::move(items[h & (N - 1)]);
+        items[h & (N - 1)] = T();
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    /* Keep the indices on separate cache lines. Padding instead of alignas,
+     * because the queue is allocated with new. */
+    std::atomic<size_t> head;   /* Next element to pop */
+    char pad1[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> tail;   /* Next free slot */
+    char pad2[64 - sizeof(std::atomic<size_t>)];
+    T items[N];
+};
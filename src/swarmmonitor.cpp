@@ -0,0 +1,307 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <QDebug>
+#include "swarmmonitor.h"
+#include "codec.h"
+
+
+/* Searches are started once this many good nodes are known */
+static const int minGoodNodes = 16;
+
+/* Start anyway after this many milliseconds */
+static const int maxWarmup = 60000;
+
+/* Milliseconds between two checks of the queue */
+static const int tickInterval = 100;
+
+/*
+ * Searches are started at up to this multiple of the rate the intervals
+ * ask for, so hashes that were delayed catch up without a burst.
+ */
+static const double rateHeadroom = 2.0;
+
+/*
+ * Fraction of the peers that were added or removed since the last search.
+ * Above the first value the interval is halved, below the second one it
+ * grows by half.
+ */
+static const double changingRatio = 0.2;
+static const double stableRatio = 0.05;
+
+
+SwarmMonitor::SwarmMonitor(DhtEngine *engine, int concurrency, QObject *parent) :
+    QObject(parent),
+    engine(engine),
+    concurrency(concurrency),
+    minInterval(300),
+    maxInterval(21600),
+    demand(0),
+    budget(0),
+    lastTick(0),
+    tickTimer(nullptr),
+    warmupTimer(nullptr)
+{
+    connect(engine, &DhtEngine::searchesChanged, this, &SwarmMonitor::searchesChanged);
+}
+
+SwarmMonitor::~SwarmMonitor()
+{
+    output.flush();
+}
+
+/**
+ * Set the bounds of the refresh intervals. Must be called before open().
+ */
+void SwarmMonitor::setIntervals(int minimum, int maximum)
+{
+    minInterval = minimum;
+    maxInterval = maximum;
+}
+
+/**
+ * Read the watched hashes, one per line. A line may give the initial
+ * interval in seconds after the hash, otherwise the minimum is used.
+ * Returns true on success.
+ */
+bool SwarmMonitor::open(const QString &path)
+{
+    QFile input;
+    bool ok;
+    if(path == "-") {
+        ok = input.open(stdin, QIODevice::ReadOnly);
+    }
+    else {
+        input.setFileName(path);
+        ok = input.open(QIODevice::ReadOnly);
+    }
+
+    if(not ok) {
+        qCritical() << "Can't open" << path;
+        return false;
+    }
+
+    quint64 lineNumber = 0;
+    while(not input.atEnd()) {
+        QByteArray line = input.readLine().simplified();
+        lineNumber++;
+        if(line.isEmpty())
+            continue;
+
+        QList<QByteArray> fields = line.split(' ');
+        Watch watch;
+        if(not Codec::parseId(fields[0], watch.id)) {
+            qWarning() << "Ignoring invalid hash on line" << lineNumber;
+            continue;
+        }
+
+        watch.interval = minInterval;
+        watch.searched = false;
+        if(fields.size() > 1) {
+            int interval = fields[1].toInt(&ok);
+            if(not ok or interval <= 0) {
+                qWarning() << "Ignoring invalid interval on line" << lineNumber;
+            }
+            else {
+                watch.interval = qBound(minInterval, interval, maxInterval);
+            }
+        }
+        watches.push_back(watch);
+    }
+
+    /* Keep the first entry of every hash */
+    std::stable_sort(watches.begin(), watches.end(), [](const Watch &a, const Watch &b) {
+        return a.id < b.id;
+    });
+    auto end = std::unique(watches.begin(), watches.end(), [](const Watch &a, const Watch &b) {
+        return a.id == b.id;
+    });
+    watches.erase(end, watches.end());
+
+    if(watches.empty()) {
+        qCritical() << "No hashes to watch in" << path;
+        return false;
+    }
+
+    return output.open(stdout, QIODevice::WriteOnly);
+}
+
+/**
+ * Start the searches as soon as the routing table is populated
+ */
+void SwarmMonitor::start(void)
+{
+    clock.start();
+    warmupTimer = new QTimer(this);
+    connect(warmupTimer, &QTimer::timeout, this, &SwarmMonitor::waitForNodes);
+    warmupTimer->start(1000);
+}
+
+/**
+ * Check if there are enough good nodes to start searching
+ */
+void SwarmMonitor::waitForNodes(void)
+{
+    int good4, good6;
+    engine->getNodeCounts(good4, good6);
+
+    if(good4 + good6 < minGoodNodes and clock.elapsed() < maxWarmup)
+        return;
+
+    qInfo() << "Watching" << watches.size() << "hashes with" << good4 + good6 << "good nodes";
+    warmupTimer->stop();
+
+    /* Spread the first searches evenly over the first interval of every hash */
+    qint64 now = clock.elapsed();
+    for(auto &watch : watches) {
+        demand += 1.0 / watch.interval;
+        schedule(&watch, now + (qint64) rand() * watch.interval * 1000 / ((qint64) RAND_MAX + 1));
+    }
+
+    lastTick = now;
+    tickTimer = new QTimer(this);
+    connect(tickTimer, &QTimer::timeout, this, &SwarmMonitor::tick);
+    tickTimer->start(tickInterval);
+}
+
+/**
+ * Collect the completed searches, they are handled at the next tick
+ */
+void SwarmMonitor::searchesChanged(const QVector<SearchChange> &changes)
+{
+    for(auto &change : changes) {
+        if(change.completed and inFlight.find(change.id))
+            completed.append(change.id);
+    }
+}
+
+/**
+ * Handle completed searches and start the due ones. The number of
+ * starts per tick is limited by a token bucket that fills with the
+ * rate the intervals ask for, so a backlog is worked off smoothly.
+ */
+void SwarmMonitor::tick(void)
+{
+    qint64 now = clock.elapsed();
+
+    for(auto &id : completed) {
+        Watch *watch = inFlight.remove(id);
+        if(watch) {
+            finishSearch(watch, engine->findSearchInfo(id));
+            engine->releaseSearch(id, this);
+        }
+    }
+    completed.clear();
+    output.flush();
+
+    double rate = rateHeadroom * demand;
+    budget = std::min(std::max(rate, 1.0), budget + rate * (now - lastTick) / 1000.0);
+    lastTick = now;
+
+    while(not queue.empty() and queue.top().first <= now and budget >= 1.0
+          and (int) inFlight.size() < concurrency) {
+        Watch *watch = queue.top().second;
+        queue.pop();
+
+        SearchInfo *info = engine->startSearch(watch->id, this);
+        if(not info) {
+            /* The DHT doesn't accept more searches right now */
+            schedule(watch, now + 1000);
+            break;
+        }
+        inFlight.insert(watch->id, watch);
+        budget -= 1.0;
+    }
+}
+
+/**
+ * Compare the peers with the last search, adapt the interval and
+ * write a line with the hash, the number of peers, the number of
+ * added and removed peers and the next interval.
+ */
+void SwarmMonitor::finishSearch(Watch *watch, SearchInfo *info)
+{
+    std::vector<uint32_t> peers;
+    if(info)
+        peers = info->results.sorted();
+
+    /* Peer ids are stable and both lists are sorted, count the differences in one pass */
+    int added = 0, removed = 0;
+    auto a = watch->peers.cbegin(), b = peers.cbegin();
+    while(a != watch->peers.cend() or b != peers.cend()) {
+        if(b == peers.cend() or (a != watch->peers.cend() and *a < *b)) {
+            removed++;
+            ++a;
+        }
+        else if(a == watch->peers.cend() or *b < *a) {
+            added++;
+            ++b;
+        }
+        else {
+            ++a;
+            ++b;
+        }
+    }
+
+    if(watch->searched) {
+        int total = peers.size() + removed;
+        double ratio = total > 0 ? (double) (added + removed) / total : 0.0;
+        if(ratio > changingRatio) {
+            setInterval(watch, std::max(minInterval, watch->interval / 2));
+        }
+        else if(ratio < stableRatio) {
+            setInterval(watch, std::min(maxInterval, watch->interval + watch->interval / 2));
+        }
+    }
+    watch->searched = true;
+    watch->peers.swap(peers);
+
+    QByteArray line;
+    Codec::appendId(line, watch->id);
+    line.append(' ');
+    line.append(QByteArray::number((quint64) watch->peers.size()));
+    line.append(' ');
+    line.append(QByteArray::number(added));
+    line.append(' ');
+    line.append(QByteArray::number(removed));
+    line.append(' ');
+    line.append(QByteArray::number(watch->interval));
+    line.append('\n');
+    output.write(line);
+
+    /* A little jitter keeps hashes with equal intervals from lining up */
+    qint64 interval = watch->interval * 1000LL;
+    qint64 jitter = interval / 10;
+    schedule(watch, clock.elapsed() + interval - jitter
+             + (qint64) rand() * 2 * jitter / ((qint64) RAND_MAX + 1));
+}
+
+void SwarmMonitor::setInterval(Watch *watch, int interval)
+{
+    demand += 1.0 / interval - 1.0 / watch->interval;
+    watch->interval = interval;
+}
+
+void SwarmMonitor::schedule(Watch *watch, qint64 due)
+{
+    queue.push(Due(due, watch));
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright 2017 Alexander Fasching
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+#include <QObject>
+#include <QFile>
+#include <QTimer>
+#include <QElapsedTimer>
+#include <QList>
+#include <QVector>
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+#include "dhtengine.h"
+
+
+/**
+ * Searches a fixed set of hashes over and over. Every hash has its own
+ * refresh interval, which shrinks while its peer set changes and grows
+ * while it is stable. Due hashes are kept in a priority queue and started
+ * at a steady rate, never with more than the given number in flight.
+ */
+class SwarmMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    SwarmMonitor(DhtEngine *engine, int concurrency, QObject *parent = 0);
+    ~SwarmMonitor();
+
+    void setIntervals(int minimum, int maximum);    /* Seconds */
+    bool open(const QString &path);     /* "-" reads from stdin */
+    void start(void);
+
+private slots:
+    void searchesChanged(const QVector<SearchChange> &changes);
+    void tick(void);
+    void waitForNodes(void);
+
+private:
+    struct Watch
+    {
+        NodeId id;
+        int interval;               /* Seconds between two searches */
+        std::vector<uint32_t> peers;    /* Peers found by the last search, sorted ids */
+        bool searched;              /* The hash was searched at least once */
+    };
+
+    typedef std::pair<qint64, Watch *> Due;     /* Due time in ms and the hash */
+
+    void schedule(Watch *watch, qint64 due);
+    void finishSearch(Watch *watch, SearchInfo *info);
+    void setInterval(Watch *watch, int interval);
+
+    DhtEngine *engine;
+    int concurrency;            /* Maximum number of searches in flight */
+    int minInterval;            /* Bounds of the refresh intervals in seconds */
+    int maxInterval;
+    QFile output;
+
+    std::vector<Watch> watches;     /* All hashes, never resized after open() */
+    std::priority_queue<Due, std::vector<Due>, std::greater<Due>> queue;   /* Hashes not in flight */
+    SearchRegistry<Watch> inFlight;     /* Searches started by the monitor */
+    QList<NodeId> completed;    /* Searches to handle at the next tick */
+
+    double demand;              /* Searches per second the current intervals ask for */
+    double budget;              /* Searches that may be started now */
+    qint64 lastTick;
+
+    QTimer *tickTimer;          /* Starts due searches */
+    QTimer *warmupTimer;        /* Polls the routing table before the start */
+    QElapsedTimer clock;
+};
@@ -21,40 +21,85 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/random.h>
 #include <openssl/sha.h>
 
+#include "sha1.h"
+#include "admission.h"
 
+
+/*
+ * Called for received and sent packets and for learned nodes, so only
+ * the blocklist applies. Rate limits are checked on the receive path.
+ */
 int dht_blacklisted(const struct sockaddr *sa, int salen)
 {
-    return 0;
+    return admission_blocked(sa, salen);
 }
 
+/*
+ * Tokens are hashed on every get_peers and announce_peer request. The SHA
+ * extensions are used directly if the CPU has them, OpenSSL otherwise.
+ */
 void dht_hash(void *hash_return, int hash_size,
               const void *v1, int len1,
               const void *v2, int len2,
               const void *v3, int len3)
 {
-    SHA_CTX c;
     unsigned char md[SHA_DIGEST_LENGTH] = {0};
 
-    SHA1_Init(&c);
-    SHA1_Update(&c, v1, len1);
-    SHA1_Update(&c, v2, len2);
-    SHA1_Update(&c, v3, len3);
-    SHA1_Final(md, &c);
+    if(sha1_accelerated()) {
+        sha1_digest3(md, v1, len1, v2, len2, v3, len3);
+    }
+    else {
+        SHA_CTX c;
+        SHA1_Init(&c);
+        SHA1_Update(&c, v1, len1);
+        SHA1_Update(&c, v2, len2);
+        SHA1_Update(&c, v3, len3);
+        SHA1_Final(md, &c);
+    }
 
     if(hash_size > SHA_DIGEST_LENGTH) {
         memcpy(hash_return, md, SHA_DIGEST_LENGTH);
-        memset(hash_return + SHA_DIGEST_LENGTH, 0, hash_size - SHA_DIGEST_LENGTH);
+        memset((char *) hash_return + SHA_DIGEST_LENGTH, 0, hash_size - SHA_DIGEST_LENGTH);
     }
     else {
         memcpy(hash_return, md, hash_size);
     }
 }
 
-int dht_random_bytes(void *buf, size_t size)
+/*
+ * Random bytes are taken from a per-thread pool that is filled with
+ * getrandom(), so most calls don't need a system call. The pools are
+ * discarded in a forked child, so it doesn't repeat the parent's bytes.
+ */
+#define RANDOM_POOL_SIZE 512
+
+static __thread struct {
+    unsigned char data[RANDOM_POOL_SIZE];
+    size_t avail;               /* Unused bytes at the start of data */
+    unsigned generation;        /* Fork generation the pool was filled in */
+} pool;
+
+static unsigned fork_generation = 0;
+static pthread_once_t fork_once = PTHREAD_ONCE_INIT;
+
+static void random_forked(void)
+{
+    __atomic_add_fetch(&fork_generation, 1, __ATOMIC_RELAXED);
+}
+
+static void random_register_fork(void)
+{
+    pthread_atfork(NULL, NULL, random_forked);
+}
+
+/* Read from /dev/urandom on kernels without getrandom() */
+static int urandom_bytes(void *buf, size_t size)
 {
     int fd, rc, save;
 
@@ -70,3 +115,50 @@ int dht_random_bytes(void *buf, size_t size)
 
     return rc;
 }
+
+/* Fill buf completely from the kernel. Returns 0 on success. */
+static int kernel_random_bytes(void *buf, size_t size)
+{
+    size_t done = 0;
+
+    while(done < size) {
+        ssize_t rc = getrandom((char *) buf + done, size - done, 0);
+        if(rc < 0 && errno == EINTR)
+            continue;
+        if(rc < 0 && errno == ENOSYS)
+            return urandom_bytes((char *) buf + done, size - done) ==
+                (int) (size - done) ? 0 : -1;
+        if(rc < 0)
+            return -1;
+        done += rc;
+    }
+    return 0;
+}
+
+int dht_random_bytes(void *buf, size_t size)
+{
+    unsigned generation;
+
+    if(size > RANDOM_POOL_SIZE / 4)
+        return kernel_random_bytes(buf, size) == 0 ? (int) size : -1;
+
+    pthread_once(&fork_once, random_register_fork);
+    generation = __atomic_load_n(&fork_generation, __ATOMIC_RELAXED);
+    if(pool.generation != generation) {
+        pool.avail = 0;
+        pool.generation = generation;
+    }
+
+    if(pool.avail < size) {
+        if(kernel_random_bytes(pool.data, RANDOM_POOL_SIZE) < 0)
+            return -1;
+        pool.avail = RANDOM_POOL_SIZE;
+    }
+
+    /* Hand out the bytes from the end and wipe them */
+    pool.avail -= size;
+    memcpy(buf, pool.data + pool.avail, size);
+    memset(pool.data + pool.avail, 0, size);
+
+    return size;
+}